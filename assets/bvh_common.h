@@ -0,0 +1,3918 @@
+#ifndef BVH_COMMON_H
+#define BVH_COMMON_H
+
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <numeric>
+#include <cassert>
+#include <array>
+#include <stack>
+#include <utility>
+#include <type_traits>
+#include <tuple>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <optional>
+#include <charconv>
+#include <string>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <locale>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// io_uring is only used when the headers have the read operation, which appeared in Linux 5.6 along
+// with IORING_FEAT_RW_CUR_POS. Otherwise, files are loaded one after the other.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define BVH_HAS_IO_URING
+#endif
+#endif
+#endif
+
+struct Vec3 {
+    float values[3];
+
+    Vec3() = default;
+    Vec3(float x, float y, float z) : values { x, y, z } {}
+    explicit Vec3(float x) : Vec3(x, x, x) {}
+
+    float& operator [] (int i) { return values[i]; }
+    float operator [] (int i) const { return values[i]; }
+};
+
+inline Vec3 operator + (const Vec3& a, const Vec3& b) {
+    return Vec3(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+}
+
+inline Vec3 operator - (const Vec3& a, const Vec3& b) {
+    return Vec3(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+}
+
+inline Vec3 operator * (const Vec3& a, const Vec3& b) {
+    return Vec3(a[0] * b[0], a[1] * b[1], a[2] * b[2]);
+}
+
+inline Vec3 operator * (const Vec3& a, float b) {
+    return Vec3(a[0] * b, a[1] * b, a[2] * b);
+}
+
+inline Vec3 operator / (const Vec3& a, const Vec3& b) {
+    return Vec3(a[0] / b[0], a[1] / b[1], a[2] / b[2]);
+}
+
+inline Vec3 operator * (float a, const Vec3& b) {
+    return b * a;
+}
+
+inline Vec3 min(const Vec3& a, const Vec3& b) {
+    return Vec3(std::min(a[0], b[0]), std::min(a[1], b[1]), std::min(a[2], b[2]));
+}
+
+inline Vec3 max(const Vec3& a, const Vec3& b) {
+    return Vec3(std::max(a[0], b[0]), std::max(a[1], b[1]), std::max(a[2], b[2]));
+}
+
+inline float dot(const Vec3& a, const Vec3& b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline float length(const Vec3& a) {
+    return std::sqrt(dot(a, a));
+}
+
+inline Vec3 normalize(const Vec3& a) {
+    return a * (1.0f / length(a));
+}
+
+inline Vec3 cross(const Vec3& a, const Vec3& b) {
+    return Vec3(
+        a[1] * b[2] - a[2] * b[1],
+        a[2] * b[0] - a[0] * b[2],
+        a[0] * b[1] - a[1] * b[0]);
+}
+
+struct BBox {
+    Vec3 min, max;
+
+    BBox() = default;
+    BBox(const Vec3& min, const Vec3& max) : min(min), max(max) {}
+    explicit BBox(const Vec3& point) : BBox(point, point) {}
+
+    BBox& extend(const Vec3& point) {
+        return extend(BBox(point));
+    }
+
+    BBox& extend(const BBox& other) {
+        min = ::min(min, other.min);
+        max = ::max(max, other.max);
+        return *this;
+    }
+
+    Vec3 diagonal() const {
+        return max - min;
+    }
+
+    int largest_axis() const {
+        auto d = diagonal();
+        int axis = 0;
+        if (d[axis] < d[1]) axis = 1;
+        if (d[axis] < d[2]) axis = 2;
+        return axis;
+    }
+
+    float half_area() const {
+        auto d = diagonal();
+        return (d[0] + d[1]) * d[2] + d[0] * d[1];
+    }
+
+    static BBox empty() {
+        return BBox(
+            Vec3(+std::numeric_limits<float>::max()),
+            Vec3(-std::numeric_limits<float>::max()));
+    }
+};
+
+struct Morton {
+    using Value = uint32_t;
+    static constexpr int log_bits = 5;
+    static constexpr size_t grid_dim = 1024;
+
+    static Value split(Value x) {
+        const int bit_count = 1 << log_bits;
+        Value mask = (static_cast<Value>(-1)) >> (bit_count / 2);
+        x &= mask;
+        for (int i = log_bits - 1, n = 1 << i; i > 0; --i, n >>= 1) {
+            mask = (mask | (mask << n)) & ~(mask << (n / 2));
+            x = (x | (x << n)) & mask;
+        }
+        return x;
+    }
+
+    static Value encode(Value x, Value y, Value z) {
+        return split(x) | (split(y) << 1) | (split(z) << 2);
+    }
+
+    // Encodes the position of a point on a grid that covers the given bounding box
+    static Value encode(const Vec3& point, const BBox& bbox) {
+        auto grid_pos =
+            min(Vec3(grid_dim - 1),
+            max(Vec3(0), (point - bbox.min) * (Vec3(grid_dim) / bbox.diagonal())));
+        return encode(grid_pos[0], grid_pos[1], grid_pos[2]);
+    }
+};
+
+inline void prefetch(const void* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr);
+#else
+    (void)ptr;
+#endif
+}
+
+inline float robust_min(float a, float b) { return a < b ? a : b; }
+inline float robust_max(float a, float b) { return a > b ? a : b; }
+inline float safe_inverse(float x) {
+    return std::fabs(x) <= std::numeric_limits<float>::epsilon()
+        ? std::copysign(1.0f / std::numeric_limits<float>::epsilon(), x)
+        : 1.0f / x;
+}
+
+struct Ray {
+    Vec3 org, dir;
+    float tmin, tmax;
+
+    Vec3 inv_dir() const {
+        return Vec3(safe_inverse(dir[0]), safe_inverse(dir[1]), safe_inverse(dir[2]));
+    }
+};
+
+// Packet of rays stored as a structure of arrays. Operations on packets are written as loops over
+// the lanes of the packet, which the compiler maps to SIMD instructions.
+template <size_t N>
+struct RayPacket {
+    using Mask = uint32_t;
+    static_assert(N <= sizeof(Mask) * 8, "Packet too large for its lane mask");
+
+    static constexpr size_t size = N;
+    static constexpr Mask all_lanes = N == sizeof(Mask) * 8 ? ~Mask(0) : (Mask(1) << N) - 1;
+
+    float org[3][N];
+    float dir[3][N];
+    float inv_dir[3][N];
+    float tmin[N];
+    float tmax[N];
+
+    Vec3 lane_org(size_t i) const { return Vec3(org[0][i], org[1][i], org[2][i]); }
+    Vec3 lane_dir(size_t i) const { return Vec3(dir[0][i], dir[1][i], dir[2][i]); }
+    Vec3 lane_inv_dir(size_t i) const { return Vec3(inv_dir[0][i], inv_dir[1][i], inv_dir[2][i]); }
+
+    void set_ray(size_t i, const Ray& ray) {
+        auto ray_inv_dir = ray.inv_dir();
+        for (int axis = 0; axis < 3; ++axis) {
+            org[axis][i] = ray.org[axis];
+            dir[axis][i] = ray.dir[axis];
+            inv_dir[axis][i] = ray_inv_dir[axis];
+        }
+        tmin[i] = ray.tmin;
+        tmax[i] = ray.tmax;
+    }
+};
+
+// Frustum enclosing a set of rays that share the same origin. Nodes are culled using both the
+// planes of the frustum, and bounds on the intersection distances obtained with interval arithmetic.
+struct Frustum {
+    Vec3 org;
+    Vec3 normals[4];
+    Vec3 inv_dir_min, inv_dir_max;
+    bool is_bounded[3];
+
+    Frustum() = default;
+
+    // The corner directions must be given in order, clockwise or counter-clockwise
+    Frustum(const Vec3& org, const Vec3 (&corners)[4]) : org(org) {
+        for (int i = 0; i < 4; ++i) {
+            normals[i] = cross(corners[i], corners[(i + 1) % 4]);
+            if (dot(normals[i], corners[(i + 2) % 4]) < 0)
+                normals[i] = normals[i] * -1.0f;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            auto min_dir = std::min({ corners[0][axis], corners[1][axis], corners[2][axis], corners[3][axis] });
+            auto max_dir = std::max({ corners[0][axis], corners[1][axis], corners[2][axis], corners[3][axis] });
+            // The inverse is only bounded if the sign of the direction is the same for all rays,
+            // and if no ray relies on `safe_inverse()`.
+            is_bounded[axis] =
+                min_dir >  std::numeric_limits<float>::epsilon() ||
+                max_dir < -std::numeric_limits<float>::epsilon();
+            inv_dir_min[axis] = is_bounded[axis] ? 1.0f / max_dir : 0;
+            inv_dir_max[axis] = is_bounded[axis] ? 1.0f / min_dir : 0;
+        }
+    }
+
+    bool intersect(const BBox& bbox, float tmin, float tmax) const {
+        for (auto& normal : normals) {
+            Vec3 farthest(
+                normal[0] > 0 ? bbox.max[0] : bbox.min[0],
+                normal[1] > 0 ? bbox.max[1] : bbox.min[1],
+                normal[2] > 0 ? bbox.max[2] : bbox.min[2]);
+            if (dot(normal, farthest - org) < 0)
+                return false;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            if (!is_bounded[axis])
+                continue;
+            auto t0 = bbox.min[axis] - org[axis];
+            auto t1 = bbox.max[axis] - org[axis];
+            if (inv_dir_min[axis] < 0)
+                std::swap(t0, t1);
+            tmin = std::max(tmin, std::min(t0 * inv_dir_min[axis], t0 * inv_dir_max[axis]));
+            tmax = std::min(tmax, std::max(t1 * inv_dir_min[axis], t1 * inv_dir_max[axis]));
+        }
+        return tmin <= tmax;
+    }
+};
+
+// Bundle of M packets of N rays, whose rays are all contained in the given frustum. Each packet
+// also comes with its own frustum.
+template <size_t N, size_t M>
+struct RayBundle {
+    Frustum frustum;
+    std::array<RayPacket<N>, M> packets;
+    std::array<Frustum, M> packet_frustums;
+
+    // Number of ray-node tests, where a frustum test counts as one
+    size_t node_tests = 0;
+
+    float max_tmax() const {
+        auto tmax = -std::numeric_limits<float>::max();
+        for (auto& packet : packets) {
+            for (size_t i = 0; i < N; ++i)
+                tmax = std::max(tmax, packet.tmax[i]);
+        }
+        return tmax;
+    }
+};
+
+// Large batch of rays stored as a structure of arrays
+struct RayStream {
+    std::vector<float> org[3];
+    std::vector<float> dir[3];
+    std::vector<float> inv_dir[3];
+    std::vector<float> tmin;
+    std::vector<float> tmax;
+
+    RayStream() = default;
+    explicit RayStream(const std::vector<Ray>& rays) {
+        for (int axis = 0; axis < 3; ++axis) {
+            org[axis].resize(rays.size());
+            dir[axis].resize(rays.size());
+            inv_dir[axis].resize(rays.size());
+        }
+        tmin.resize(rays.size());
+        tmax.resize(rays.size());
+        for (size_t i = 0; i < rays.size(); ++i) {
+            auto ray_inv_dir = rays[i].inv_dir();
+            for (int axis = 0; axis < 3; ++axis) {
+                org[axis][i] = rays[i].org[axis];
+                dir[axis][i] = rays[i].dir[axis];
+                inv_dir[axis][i] = ray_inv_dir[axis];
+            }
+            tmin[i] = rays[i].tmin;
+            tmax[i] = rays[i].tmax;
+        }
+    }
+
+    size_t size() const { return tmin.size(); }
+
+    Ray ray(size_t i) const {
+        return Ray { Vec3(org[0][i], org[1][i], org[2][i]), Vec3(dir[0][i], dir[1][i], dir[2][i]), tmin[i], tmax[i] };
+    }
+
+    Vec3 ray_inv_dir(size_t i) const {
+        return Vec3(inv_dir[0][i], inv_dir[1][i], inv_dir[2][i]);
+    }
+};
+
+// Inputs of the BVH builders. The loaders can fill them while they produce the primitives, which
+// avoids another pass over the primitives before the build starts.
+struct BuildInput {
+    std::vector<BBox> bboxes;
+    std::vector<Vec3> centers;
+    BBox center_bbox = BBox::empty();
+
+    // Morton codes of the centers within `center_bbox`, only computed for the builders that use them
+    bool with_mortons = false;
+    std::vector<Morton::Value> mortons;
+
+    size_t prim_count() const { return bboxes.size(); }
+
+    void resize(size_t prim_count) {
+        bboxes.resize(prim_count);
+        centers.resize(prim_count);
+        if (with_mortons)
+            mortons.resize(prim_count);
+    }
+
+    // Must be called once `center_bbox` contains all the centers
+    void compute_mortons(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            mortons[i] = Morton::encode(centers[i], center_bbox);
+    }
+};
+
+// The index type determines how many primitives and nodes a BVH can hold, as well as the size of
+// its nodes. 32-bit indices are enough for most scenes, and are used by default.
+template <typename Index>
+struct BasicHit {
+    Index prim_index;
+
+    operator bool () const { return prim_index != static_cast<Index>(-1); }
+    static BasicHit none() { return BasicHit { static_cast<Index>(-1) }; }
+
+    // Intersects the given primitive, and records it if it is closer than the current hit
+    template <typename Prim>
+    bool intersect(Index index, const Prim& prim, Ray& ray) {
+        if (!prim.intersect(ray))
+            return false;
+        prim_index = index;
+        return true;
+    }
+};
+
+// Hit record that also contains the distance to the hit point and its barycentric coordinates, for
+// callers that need to shade it. The primitives must provide `intersect(ray, u, v)`. Only the
+// single-ray traversal returns such records: the packet, frustum and stream traversals return a
+// `Hit`, from which the caller can recompute the rest by intersecting the primitive again.
+template <typename Index>
+struct BasicSurfaceHit {
+    Index prim_index;
+    float t, u, v;
+
+    operator bool () const { return prim_index != static_cast<Index>(-1); }
+    static BasicSurfaceHit none() { return BasicSurfaceHit { static_cast<Index>(-1), 0, 0, 0 }; }
+
+    template <typename Prim>
+    bool intersect(Index index, const Prim& prim, Ray& ray) {
+        float prim_u, prim_v;
+        if (!prim.intersect(ray, prim_u, prim_v))
+            return false;
+        prim_index = index;
+        t = ray.tmax;
+        u = prim_u;
+        v = prim_v;
+        return true;
+    }
+};
+
+template <typename Index>
+struct BasicNode {
+    BBox bbox;
+    Index prim_count;
+    Index first_index;
+
+    BasicNode() = default;
+    BasicNode(const BBox& bbox, Index prim_count, Index first_index)
+        : bbox(bbox), prim_count(prim_count), first_index(first_index)
+    {}
+
+    bool is_leaf() const { return prim_count != 0; }
+
+    struct Intersection {
+        float tmin;
+        float tmax;
+        operator bool () const { return tmin <= tmax; }
+    };
+
+    Intersection intersect(const Ray& ray) const {
+        return intersect(bbox, ray, ray.inv_dir());
+    }
+
+    static Intersection intersect(const BBox& bbox, const Ray& ray, const Vec3& inv_dir) {
+        auto tmin = (bbox.min - ray.org) * inv_dir;
+        auto tmax = (bbox.max - ray.org) * inv_dir;
+        std::tie(tmin, tmax) = std::make_pair(min(tmin, tmax), max(tmin, tmax));
+        return Intersection {
+            robust_max(tmin[0], robust_max(tmin[1], robust_max(tmin[2], ray.tmin))),
+            robust_min(tmax[0], robust_min(tmax[1], robust_min(tmax[2], ray.tmax))) };
+    }
+
+    // Returns the mask of the lanes of the packet that intersect the node
+    template <size_t N>
+    typename RayPacket<N>::Mask intersect(const RayPacket<N>& packet) const {
+        bool hits[N];
+        for (size_t i = 0; i < N; ++i) {
+            auto tmin = (bbox.min - packet.lane_org(i)) * packet.lane_inv_dir(i);
+            auto tmax = (bbox.max - packet.lane_org(i)) * packet.lane_inv_dir(i);
+            std::tie(tmin, tmax) = std::make_pair(min(tmin, tmax), max(tmin, tmax));
+            hits[i] =
+                robust_max(tmin[0], robust_max(tmin[1], robust_max(tmin[2], packet.tmin[i]))) <=
+                robust_min(tmax[0], robust_min(tmax[1], robust_min(tmax[2], packet.tmax[i])));
+        }
+        typename RayPacket<N>::Mask mask = 0;
+        for (size_t i = 0; i < N; ++i)
+            mask |= static_cast<typename RayPacket<N>::Mask>(hits[i]) << i;
+        return mask;
+    }
+};
+
+// Order of the nodes in memory. The builders place the two children of a node next to each
+// other, but the nodes can be reordered afterwards. In the depth-first layout, the left child
+// is placed right after its parent, and only the index of the right child is stored.
+enum class BvhLayout {
+    SiblingPairs,
+    DepthFirst,
+    VanEmdeBoas
+};
+
+template <typename Index>
+struct BasicBvh {
+    using Hit = BasicHit<Index>;
+    using SurfaceHit = BasicSurfaceHit<Index>;
+    using Node = BasicNode<Index>;
+    using Layout = BvhLayout;
+
+    std::vector<Node> nodes;
+    std::vector<Index> prim_indices;
+    Layout layout = Layout::SiblingPairs;
+
+    // Index of the node that follows the subtree of every node, in the depth-first layout. These
+    // links are used by the stackless traversal, and are reset when the nodes are reordered.
+    std::vector<Index> skip_indices;
+
+    BasicBvh() = default;
+
+    // The number of primitives must be accepted by `can_index()`
+    static BasicBvh build(const BBox* bboxes, const Vec3* centers, size_t prim_count);
+    static BasicBvh build(const BuildInput& input);
+
+    // Returns true if the nodes of a BVH over the given number of primitives can be referred to with
+    // the index type. A BVH has at most `2 * prim_count - 1` nodes.
+    static bool can_index(size_t prim_count) {
+        return prim_count <= std::numeric_limits<Index>::max() / 2 + 1;
+    }
+
+    size_t left_child(size_t node_index) const {
+        return layout == Layout::DepthFirst ? node_index + 1 : nodes[node_index].first_index;
+    }
+
+    size_t right_child(size_t node_index) const {
+        return layout == Layout::DepthFirst ? nodes[node_index].first_index : nodes[node_index].first_index + 1;
+    }
+
+    size_t depth(size_t node_index = 0) const {
+        auto& node = nodes[node_index];
+        return node.is_leaf() ? 1 : 1 + std::max(depth(left_child(node_index)), depth(right_child(node_index)));
+    }
+
+    void reorder(Layout new_layout);
+    void compute_skip_indices();
+
+    // Returns the closest hit along the ray, as a `Hit` or a `SurfaceHit`. The primitives can be
+    // given by any container that can be indexed, such as a `Mesh`. This is the only traversal that
+    // supports surface hits.
+    template <typename HitRecord = Hit, typename Prims>
+    HitRecord traverse(Ray& ray, const Prims& prims) const;
+
+    template <size_t N, typename Prims>
+    std::array<Hit, N> traverse(RayPacket<N>& packet, const Prims& prims) const;
+
+    template <size_t N, size_t M, typename Prim>
+    std::array<std::array<Hit, N>, M> traverse(RayBundle<N, M>& bundle, const std::vector<Prim>& prims) const;
+
+    template <typename Prim>
+    std::vector<Hit> traverse(RayStream& stream, const std::vector<Prim>& prims) const;
+
+    template <typename Prim>
+    std::vector<Hit> traverse(std::vector<Ray>& rays, const std::vector<Prim>& prims) const;
+
+    template <size_t N, typename Prim>
+    std::vector<Hit> traverse_interleaved(std::vector<Ray>& rays, const std::vector<Prim>& prims) const;
+
+    // Same as `traverse()`, but prefetches the children of every visited node, and the node that is
+    // `Distance` entries below the top of the stack. With a distance of zero, no prefetch instruction
+    // is emitted.
+    template <size_t Distance, typename Prim>
+    Hit traverse_prefetched(Ray& ray, const std::vector<Prim>& prims) const;
+
+    template <typename Prim>
+    Hit traverse_stackless(Ray& ray, const std::vector<Prim>& prims) const;
+
+    // Copies the given primitives in the order in which the leaves reference them
+    template <typename Prim, typename T>
+    std::vector<Prim> leaf_ordered(const std::vector<T>& prims) const {
+        std::vector<Prim> ordered_prims;
+        ordered_prims.reserve(prim_indices.size());
+        for (auto prim_index : prim_indices)
+            ordered_prims.emplace_back(prims[prim_index]);
+        return ordered_prims;
+    }
+
+    // Turns every subtree that contains at most `max_prims` primitives into a single leaf. This is
+    // used to fill blocks of primitives, regardless of the leaf size chosen by the builder.
+    void collapse_leaves(size_t max_prims);
+
+    // Packs the primitives of every leaf into blocks, padding the last block of a leaf if needed.
+    // Leaves are rewritten to refer to their first block, and the primitive indices to give the
+    // primitive stored in each lane of each block.
+    template <typename Block, typename T>
+    std::vector<Block> pack_leaves(const std::vector<T>& prims);
+
+    template <typename Block>
+    Hit traverse_blocks(Ray& ray, const std::vector<Block>& blocks) const;
+
+    // Permutes the primitives in place, so that they are stored in leaf order. The primitive indices
+    // are not needed anymore after this, and are returned to the caller, which can use them to
+    // recover the original index of each primitive. The tree must then be traversed with
+    // `traverse_ordered()`.
+    template <typename Prim>
+    std::vector<Index> permute(std::vector<Prim>& prims);
+
+    // Same as `traverse()`, for primitives that are stored in leaf order. The index in the returned
+    // hit is the position of the primitive in that order.
+    template <typename Prim>
+    Hit traverse_ordered(Ray& ray, const std::vector<Prim>& ordered_prims) const;
+};
+
+using Hit = BasicHit<uint32_t>;
+using SurfaceHit = BasicSurfaceHit<uint32_t>;
+using Node = BasicNode<uint32_t>;
+using Bvh = BasicBvh<uint32_t>;
+
+// Builder that produced a BVH, along with its parameters, as recorded in BVH files
+struct BuilderRecord {
+    char name[16];
+    uint32_t min_prims;
+    uint32_t max_prims;
+    float traversal_cost;
+    uint32_t search_radius;
+};
+
+struct Triangle {
+    Vec3 p0, p1, p2;
+
+    Triangle() = default;
+    Triangle(const Vec3& p0, const Vec3& p1, const Vec3& p2)
+        : p0(p0), p1(p1), p2(p2)
+    {}
+
+    bool intersect(Ray& ray) const;
+
+    // Same as above, but also returns the barycentric coordinates of the hit point with respect to
+    // `p1` and `p2`, respectively
+    bool intersect(Ray& ray, float& u, float& v) const;
+
+    // Intersects the lanes of the packet enabled in the given mask, and returns the lanes that hit
+    template <size_t N>
+    typename RayPacket<N>::Mask intersect(RayPacket<N>& packet, typename RayPacket<N>::Mask mask) const;
+};
+
+inline bool Triangle::intersect(Ray& ray) const {
+    float u, v;
+    return intersect(ray, u, v);
+}
+
+inline bool Triangle::intersect(Ray& ray, float& hit_u, float& hit_v) const {
+    auto e1 = p0 - p1;
+    auto e2 = p2 - p0;
+    auto n = cross(e1, e2);
+
+    auto c = p0 - ray.org;
+    auto r = cross(ray.dir, c);
+    auto inv_det = 1.0f / dot(n, ray.dir);
+
+    auto u = dot(r, e2) * inv_det;
+    auto v = dot(r, e1) * inv_det;
+    auto w = 1.0f - u - v;
+
+    // These comparisons are designed to return false
+    // when one of t, u, or v is a NaN
+    if (u >= 0 && v >= 0 && w >= 0) {
+        auto t = dot(n, c) * inv_det;
+        if (t >= ray.tmin && t <= ray.tmax) {
+            ray.tmax = t;
+            hit_u = u;
+            hit_v = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Triangle mesh in which vertices are shared between triangles. Every triangle is given by three
+// consecutive indices into the vertex buffer.
+struct Mesh {
+    std::vector<Vec3> vertices;
+    std::vector<uint32_t> indices;
+
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    // Builds the triangle with the given index on the fly, so that the mesh can be traversed like
+    // an array of triangles
+    Triangle operator [] (size_t i) const {
+        return Triangle(vertices[indices[3 * i + 0]], vertices[indices[3 * i + 1]], vertices[indices[3 * i + 2]]);
+    }
+
+    BBox bbox(size_t i) const {
+        return BBox(vertices[indices[3 * i + 0]]).extend(vertices[indices[3 * i + 1]]).extend(vertices[indices[3 * i + 2]]);
+    }
+
+    Vec3 center(size_t i) const {
+        return (vertices[indices[3 * i + 0]] + vertices[indices[3 * i + 1]] + vertices[indices[3 * i + 2]]) * (1.0f / 3.0f);
+    }
+
+    std::vector<Triangle> triangles() const {
+        std::vector<Triangle> triangles(triangle_count());
+        for (size_t i = 0; i < triangles.size(); ++i)
+            triangles[i] = (*this)[i];
+        return triangles;
+    }
+};
+
+// Triangle whose edges and normal are computed once, instead of for every intersection test
+struct PrecomputedTriangle {
+    Vec3 p0, e1, e2, n;
+
+    PrecomputedTriangle() = default;
+    PrecomputedTriangle(const Triangle& triangle)
+        : p0(triangle.p0)
+        , e1(triangle.p0 - triangle.p1)
+        , e2(triangle.p2 - triangle.p0)
+        , n(cross(e1, e2))
+    {}
+
+    bool intersect(Ray& ray) const;
+    bool intersect(Ray& ray, float& u, float& v) const;
+};
+
+inline bool PrecomputedTriangle::intersect(Ray& ray) const {
+    float u, v;
+    return intersect(ray, u, v);
+}
+
+inline bool PrecomputedTriangle::intersect(Ray& ray, float& hit_u, float& hit_v) const {
+    auto c = p0 - ray.org;
+    auto r = cross(ray.dir, c);
+    auto inv_det = 1.0f / dot(n, ray.dir);
+
+    auto u = dot(r, e2) * inv_det;
+    auto v = dot(r, e1) * inv_det;
+    auto w = 1.0f - u - v;
+
+    // See `Triangle::intersect()`
+    if (u >= 0 && v >= 0 && w >= 0) {
+        auto t = dot(n, c) * inv_det;
+        if (t >= ray.tmin && t <= ray.tmax) {
+            ray.tmax = t;
+            hit_u = u;
+            hit_v = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Block of triangles stored as a structure of arrays, with precomputed edges and normals. All the
+// triangles of a block are intersected at once against a single ray. Unused lanes contain NaNs,
+// which never produce an intersection.
+struct alignas(32) TriangleBlock {
+    static constexpr size_t size = 8;
+
+    float p0[3][size];
+    float e1[3][size];
+    float e2[3][size];
+    float n[3][size];
+
+    TriangleBlock() {
+        for (int axis = 0; axis < 3; ++axis) {
+            for (size_t i = 0; i < size; ++i)
+                p0[axis][i] = e1[axis][i] = e2[axis][i] = n[axis][i] = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+
+    void set_triangle(size_t i, const PrecomputedTriangle& triangle) {
+        for (int axis = 0; axis < 3; ++axis) {
+            p0[axis][i] = triangle.p0[axis];
+            e1[axis][i] = triangle.e1[axis];
+            e2[axis][i] = triangle.e2[axis];
+            n [axis][i] = triangle.n [axis];
+        }
+    }
+
+    // Returns the lane of the closest intersection, or -1 if there is none
+    int intersect(Ray& ray) const;
+};
+
+inline int TriangleBlock::intersect(Ray& ray) const {
+#if defined(__AVX2__)
+    static_assert(size == 8, "The AVX2 kernel expects blocks of 8 triangles");
+    auto cx = _mm256_sub_ps(_mm256_load_ps(p0[0]), _mm256_set1_ps(ray.org[0]));
+    auto cy = _mm256_sub_ps(_mm256_load_ps(p0[1]), _mm256_set1_ps(ray.org[1]));
+    auto cz = _mm256_sub_ps(_mm256_load_ps(p0[2]), _mm256_set1_ps(ray.org[2]));
+    auto dx = _mm256_set1_ps(ray.dir[0]);
+    auto dy = _mm256_set1_ps(ray.dir[1]);
+    auto dz = _mm256_set1_ps(ray.dir[2]);
+    auto dot = [] (__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) {
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+    };
+
+    // r = cross(ray.dir, c)
+    auto rx = _mm256_sub_ps(_mm256_mul_ps(dy, cz), _mm256_mul_ps(dz, cy));
+    auto ry = _mm256_sub_ps(_mm256_mul_ps(dz, cx), _mm256_mul_ps(dx, cz));
+    auto rz = _mm256_sub_ps(_mm256_mul_ps(dx, cy), _mm256_mul_ps(dy, cx));
+    auto nx = _mm256_load_ps(n[0]);
+    auto ny = _mm256_load_ps(n[1]);
+    auto nz = _mm256_load_ps(n[2]);
+    auto inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), dot(nx, ny, nz, dx, dy, dz));
+
+    auto u = _mm256_mul_ps(dot(rx, ry, rz, _mm256_load_ps(e2[0]), _mm256_load_ps(e2[1]), _mm256_load_ps(e2[2])), inv_det);
+    auto v = _mm256_mul_ps(dot(rx, ry, rz, _mm256_load_ps(e1[0]), _mm256_load_ps(e1[1]), _mm256_load_ps(e1[2])), inv_det);
+    auto w = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), u), v);
+    auto t = _mm256_mul_ps(dot(nx, ny, nz, cx, cy, cz), inv_det);
+
+    // Ordered comparisons return false when one of the operands is a NaN
+    auto zero = _mm256_setzero_ps();
+    auto mask = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_GE_OQ),
+        _mm256_and_ps(
+            _mm256_cmp_ps(t, _mm256_set1_ps(ray.tmin), _CMP_GE_OQ),
+            _mm256_cmp_ps(t, _mm256_set1_ps(ray.tmax), _CMP_LE_OQ))));
+    if (!_mm256_movemask_ps(mask))
+        return -1;
+
+    // Masked min-reduction over the lanes
+    auto masked_t = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), t, mask);
+    auto min_t = _mm256_min_ps(masked_t, _mm256_permute2f128_ps(masked_t, masked_t, 1));
+    min_t = _mm256_min_ps(min_t, _mm256_shuffle_ps(min_t, min_t, _MM_SHUFFLE(1, 0, 3, 2)));
+    min_t = _mm256_min_ps(min_t, _mm256_shuffle_ps(min_t, min_t, _MM_SHUFFLE(2, 3, 0, 1)));
+    auto lanes = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(masked_t, min_t, _CMP_EQ_OQ), mask));
+
+    // Like the scalar version, the last of several equally close triangles is chosen
+    int lane = 31 - __builtin_clz(lanes);
+    ray.tmax = _mm256_cvtss_f32(min_t);
+    return lane;
+#else
+    int lane = -1;
+    for (size_t i = 0; i < size; ++i) {
+        PrecomputedTriangle triangle;
+        triangle.p0 = Vec3(p0[0][i], p0[1][i], p0[2][i]);
+        triangle.e1 = Vec3(e1[0][i], e1[1][i], e1[2][i]);
+        triangle.e2 = Vec3(e2[0][i], e2[1][i], e2[2][i]);
+        triangle.n  = Vec3(n [0][i], n [1][i], n [2][i]);
+        if (triangle.intersect(ray))
+            lane = i;
+    }
+    return lane;
+#endif
+}
+
+template <size_t N>
+typename RayPacket<N>::Mask Triangle::intersect(RayPacket<N>& packet, typename RayPacket<N>::Mask mask) const {
+    auto e1 = p0 - p1;
+    auto e2 = p2 - p0;
+    auto n = cross(e1, e2);
+
+    bool hits[N];
+    for (size_t i = 0; i < N; ++i) {
+        auto dir = packet.lane_dir(i);
+        auto c = p0 - packet.lane_org(i);
+        auto r = cross(dir, c);
+        auto inv_det = 1.0f / dot(n, dir);
+
+        auto u = dot(r, e2) * inv_det;
+        auto v = dot(r, e1) * inv_det;
+        auto w = 1.0f - u - v;
+        auto t = dot(n, c) * inv_det;
+
+        // Same as for single rays, but all the lanes are computed
+        hits[i] = ((mask >> i) & 1) &&
+            u >= 0 && v >= 0 && w >= 0 &&
+            t >= packet.tmin[i] && t <= packet.tmax[i];
+        packet.tmax[i] = hits[i] ? t : packet.tmax[i];
+    }
+    typename RayPacket<N>::Mask hit_mask = 0;
+    for (size_t i = 0; i < N; ++i)
+        hit_mask |= static_cast<typename RayPacket<N>::Mask>(hits[i]) << i;
+    return hit_mask;
+}
+
+template <typename Index>
+template <typename HitRecord, typename Prims>
+HitRecord BasicBvh<Index>::traverse(Ray& ray, const Prims& prims) const {
+    auto hit = HitRecord::none();
+    std::stack<Index> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        auto node_index = stack.top();
+        auto& node = nodes[node_index];
+        stack.pop();
+        if (!node.intersect(ray))
+            continue;
+
+        if (node.is_leaf()) {
+            for (size_t i = 0; i < node.prim_count; ++i) {
+                auto prim_index = prim_indices[node.first_index + i];
+                hit.intersect(prim_index, prims[prim_index], ray);
+            }
+        } else {
+            stack.push(left_child(node_index));
+            stack.push(right_child(node_index));
+        }
+    }
+    return hit;
+}
+
+template <typename Index>
+template <size_t N, typename Prims>
+std::array<BasicHit<Index>, N> BasicBvh<Index>::traverse(RayPacket<N>& packet, const Prims& prims) const {
+    using Mask = typename RayPacket<N>::Mask;
+    std::array<Hit, N> hits;
+    hits.fill(Hit::none());
+    // Each node is visited with the mask of the lanes that intersected its parent, and is culled
+    // when none of those lanes intersects it within their current interval.
+    std::stack<std::pair<Index, Mask>> stack;
+    stack.emplace(0, RayPacket<N>::all_lanes);
+    while (!stack.empty()) {
+        auto [node_index, mask] = stack.top();
+        auto& node = nodes[node_index];
+        stack.pop();
+        mask &= node.intersect(packet);
+        if (!mask)
+            continue;
+
+        if (node.is_leaf()) {
+            for (size_t i = 0; i < node.prim_count; ++i) {
+                auto prim_index = prim_indices[node.first_index + i];
+                auto hit_mask = prims[prim_index].intersect(packet, mask);
+                for (size_t j = 0; j < N; ++j) {
+                    if ((hit_mask >> j) & 1)
+                        hits[j].prim_index = prim_index;
+                }
+            }
+        } else {
+            stack.emplace(left_child(node_index), mask);
+            stack.emplace(right_child(node_index), mask);
+        }
+    }
+    return hits;
+}
+
+template <typename Index>
+template <size_t N, size_t M, typename Prim>
+std::array<std::array<BasicHit<Index>, N>, M> BasicBvh<Index>::traverse(RayBundle<N, M>& bundle, const std::vector<Prim>& prims) const {
+    std::array<std::array<Hit, N>, M> hits;
+    for (auto& packet_hits : hits)
+        packet_hits.fill(Hit::none());
+
+    // Rays are assumed to start at the origin of the frustum. The maximum distance over all the rays
+    // is only updated when a leaf produces an intersection.
+    float tmin = 0;
+    float tmax = bundle.max_tmax();
+
+    // Each node is visited with the index of the first packet that intersected its parent
+    std::stack<std::pair<Index, size_t>> stack;
+    stack.emplace(0, 0);
+    while (!stack.empty()) {
+        auto [node_index, first_packet] = stack.top();
+        auto& node = nodes[node_index];
+        stack.pop();
+
+        bundle.node_tests++;
+        if (!bundle.frustum.intersect(node.bbox, tmin, tmax))
+            continue;
+
+        // Fall back to packets when the frustum intersects the node, and to individual rays when
+        // the frustum of a packet intersects it.
+        auto intersect_packet = [&] (size_t i) -> typename RayPacket<N>::Mask {
+            bundle.node_tests++;
+            if (!bundle.packet_frustums[i].intersect(node.bbox, tmin, tmax))
+                return 0;
+            bundle.node_tests += N;
+            return node.intersect(bundle.packets[i]);
+        };
+        typename RayPacket<N>::Mask first_mask = 0;
+        while (first_packet < M && !(first_mask = intersect_packet(first_packet)))
+            first_packet++;
+        if (first_packet == M)
+            continue;
+
+        if (node.is_leaf()) {
+            bool has_hit = false;
+            for (size_t i = first_packet; i < M; ++i) {
+                auto& packet = bundle.packets[i];
+                auto mask = i == first_packet ? first_mask : intersect_packet(i);
+                for (size_t j = 0; j < node.prim_count && mask; ++j) {
+                    auto prim_index = prim_indices[node.first_index + j];
+                    auto hit_mask = prims[prim_index].intersect(packet, mask);
+                    for (size_t k = 0; k < N; ++k) {
+                        if ((hit_mask >> k) & 1)
+                            hits[i][k].prim_index = prim_index;
+                    }
+                    has_hit |= hit_mask != 0;
+                }
+            }
+            if (has_hit)
+                tmax = bundle.max_tmax();
+        } else {
+            stack.emplace(left_child(node_index), first_packet);
+            stack.emplace(right_child(node_index), first_packet);
+        }
+    }
+    return hits;
+}
+
+template <typename Index>
+template <typename Prim>
+std::vector<BasicHit<Index>> BasicBvh<Index>::traverse(RayStream& stream, const std::vector<Prim>& prims) const {
+    std::vector<Hit> hits(stream.size(), Hit::none());
+
+    // The indices of the rays that enter a node are stored contiguously in a buffer. Because nodes
+    // are processed in stack order, the rays of a node that is popped are always at the end of the
+    // buffer, and what comes after them belongs to nodes that have already been processed.
+    std::vector<uint32_t> ray_indices(stream.size());
+    std::iota(ray_indices.begin(), ray_indices.end(), 0);
+
+    struct Range { Index node_index; size_t begin, end; };
+    std::stack<Range> stack;
+    stack.push(Range { 0, 0, ray_indices.size() });
+    while (!stack.empty()) {
+        auto [node_index, begin, end] = stack.top();
+        auto& node = nodes[node_index];
+        stack.pop();
+        ray_indices.resize(end);
+
+        // Keep the rays that intersect the node
+        for (size_t i = begin; i < end; ++i) {
+            auto ray_index = ray_indices[i];
+            if (Node::intersect(node.bbox, stream.ray(ray_index), stream.ray_inv_dir(ray_index)))
+                ray_indices.push_back(ray_index);
+        }
+        begin = end;
+        end = ray_indices.size();
+        if (begin == end)
+            continue;
+
+        if (node.is_leaf()) {
+            for (size_t i = 0; i < node.prim_count; ++i) {
+                auto prim_index = prim_indices[node.first_index + i];
+                auto& prim = prims[prim_index];
+                for (size_t j = begin; j < end; ++j) {
+                    auto ray_index = ray_indices[j];
+                    auto ray = stream.ray(ray_index);
+                    if (prim.intersect(ray)) {
+                        stream.tmax[ray_index] = ray.tmax;
+                        hits[ray_index].prim_index = prim_index;
+                    }
+                }
+            }
+        } else {
+            stack.push(Range { static_cast<Index>(left_child(node_index)), begin, end });
+            stack.push(Range { static_cast<Index>(right_child(node_index)), begin, end });
+        }
+    }
+    return hits;
+}
+
+template <typename Index>
+template <typename Prim>
+std::vector<BasicHit<Index>> BasicBvh<Index>::traverse(std::vector<Ray>& rays, const std::vector<Prim>& prims) const {
+    RayStream stream(rays);
+    auto hits = traverse(stream, prims);
+    for (size_t i = 0; i < rays.size(); ++i)
+        rays[i].tmax = stream.tmax[i];
+    return hits;
+}
+
+// Traverses N rays at the same time, switching to another ray after every step. Each step prefetches
+// the data needed by the next step of the same ray, so that memory accesses of one ray overlap with
+// the computations of the others. Every ray sees the same tests as with single-ray traversal.
+template <typename Index>
+template <size_t N, typename Prim>
+std::vector<BasicHit<Index>> BasicBvh<Index>::traverse_interleaved(std::vector<Ray>& rays, const std::vector<Prim>& prims) const {
+    enum class State {
+        Done,       // The slot has no ray to trace
+        Node,       // The node at the top of the stack has been prefetched
+        LeafIndices,// The primitive indices of the current leaf have been prefetched
+        LeafPrims   // The primitives of the current leaf have been prefetched
+    };
+    struct Slot {
+        State state = State::Done;
+        size_t ray_index = 0;
+        Vec3 inv_dir;
+        Index leaf_index;
+        std::vector<Index> stack;
+    };
+
+    std::vector<Hit> hits(rays.size(), Hit::none());
+    std::array<Slot, N> slots;
+    size_t next_ray = 0;
+    auto start_ray = [&] (Slot& slot) {
+        if (next_ray >= rays.size()) {
+            slot.state = State::Done;
+            return false;
+        }
+        slot.ray_index = next_ray++;
+        slot.inv_dir = rays[slot.ray_index].inv_dir();
+        slot.stack.clear();
+        slot.stack.push_back(0);
+        slot.state = State::Node;
+        prefetch(&nodes[0]);
+        return true;
+    };
+
+    size_t active_count = 0;
+    for (auto& slot : slots)
+        active_count += start_ray(slot) ? 1 : 0;
+
+    while (active_count > 0) {
+        for (auto& slot : slots) {
+            auto& ray = rays[slot.ray_index];
+            switch (slot.state) {
+                case State::Done:
+                    continue;
+                case State::Node: {
+                    auto node_index = slot.stack.back();
+                    auto& node = nodes[node_index];
+                    slot.stack.pop_back();
+                    if (Node::intersect(node.bbox, ray, slot.inv_dir)) {
+                        if (node.is_leaf()) {
+                            slot.leaf_index = node_index;
+                            slot.state = State::LeafIndices;
+                            prefetch(&prim_indices[node.first_index]);
+                            continue;
+                        }
+                        slot.stack.push_back(left_child(node_index));
+                        slot.stack.push_back(right_child(node_index));
+                    }
+                    break;
+                }
+                case State::LeafIndices: {
+                    auto& node = nodes[slot.leaf_index];
+                    for (size_t i = 0; i < node.prim_count; ++i)
+                        prefetch(&prims[prim_indices[node.first_index + i]]);
+                    slot.state = State::LeafPrims;
+                    continue;
+                }
+                case State::LeafPrims: {
+                    auto& node = nodes[slot.leaf_index];
+                    for (size_t i = 0; i < node.prim_count; ++i) {
+                        auto prim_index = prim_indices[node.first_index + i];
+                        if (prims[prim_index].intersect(ray))
+                            hits[slot.ray_index].prim_index = prim_index;
+                    }
+                    slot.state = State::Node;
+                    break;
+                }
+            }
+
+            if (!slot.stack.empty())
+                prefetch(&nodes[slot.stack.back()]);
+            else if (!start_ray(slot))
+                active_count--;
+        }
+    }
+    return hits;
+}
+
+template <typename Index>
+template <size_t Distance, typename Prim>
+BasicHit<Index> BasicBvh<Index>::traverse_prefetched(Ray& ray, const std::vector<Prim>& prims) const {
+    auto hit = Hit::none();
+    std::vector<Index> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+    while (!stack.empty()) {
+        auto node_index = stack.back();
+        auto& node = nodes[node_index];
+        stack.pop_back();
+        if constexpr (Distance > 0) {
+            // This node is popped after the current subtree is done, and is likely to have been
+            // evicted from the cache since it was pushed
+            if (stack.size() >= Distance)
+                prefetch(&nodes[stack[stack.size() - Distance]]);
+        }
+        if (!node.intersect(ray))
+            continue;
+
+        if (node.is_leaf()) {
+            for (size_t i = 0; i < node.prim_count; ++i) {
+                auto prim_index = prim_indices[node.first_index + i];
+                if (prims[prim_index].intersect(ray))
+                    hit.prim_index = prim_index;
+            }
+        } else {
+            auto left = left_child(node_index);
+            auto right = right_child(node_index);
+            if constexpr (Distance > 0) {
+                prefetch(&nodes[left]);
+                prefetch(&nodes[right]);
+            }
+            stack.push_back(left);
+            stack.push_back(right);
+        }
+    }
+    return hit;
+}
+
+// Sorts rays so that rays with similar origins and directions are traced one after the other. The
+// sort key is made of the Morton code of the origin within the given bounding box, followed by the
+// Morton code of the direction. Returns the original index of each ray.
+inline std::vector<size_t> sort_rays(std::vector<Ray>& rays, const BBox& bbox) {
+    std::vector<uint64_t> keys(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i) {
+        auto org_pos =
+            min(Vec3(Morton::grid_dim - 1),
+            max(Vec3(0), (rays[i].org - bbox.min) * (Vec3(Morton::grid_dim) / bbox.diagonal())));
+        auto dir_pos =
+            min(Vec3(Morton::grid_dim - 1),
+            max(Vec3(0), (normalize(rays[i].dir) + Vec3(1.0f)) * (0.5f * Morton::grid_dim)));
+        keys[i] =
+            (static_cast<uint64_t>(Morton::encode(org_pos[0], org_pos[1], org_pos[2])) << 32) |
+            Morton::encode(dir_pos[0], dir_pos[1], dir_pos[2]);
+    }
+
+    std::vector<size_t> order(rays.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&] (size_t i, size_t j) { return keys[i] < keys[j]; });
+
+    std::vector<Ray> sorted_rays(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i)
+        sorted_rays[i] = rays[order[i]];
+    std::swap(rays, sorted_rays);
+    return order;
+}
+
+template <typename Index>
+template <typename Prim>
+std::vector<Index> BasicBvh<Index>::permute(std::vector<Prim>& prims) {
+    // The primitive at position `i` moves to the position that refers to it in `prim_indices`. This
+    // forms cycles, which are followed with a single temporary, and one bit per primitive to mark
+    // the positions that have been filled.
+    assert(prim_indices.size() == prims.size());
+    std::vector<bool> filled(prims.size(), false);
+    for (size_t i = 0; i < prims.size(); ++i) {
+        if (filled[i])
+            continue;
+        auto first = std::move(prims[i]);
+        size_t j = i;
+        while (prim_indices[j] != i) {
+            prims[j] = std::move(prims[prim_indices[j]]);
+            filled[j] = true;
+            j = prim_indices[j];
+        }
+        prims[j] = std::move(first);
+        filled[j] = true;
+    }
+    std::vector<Index> original_indices;
+    std::swap(original_indices, prim_indices);
+    return original_indices;
+}
+
+template <typename Index>
+template <typename Prim>
+BasicHit<Index> BasicBvh<Index>::traverse_ordered(Ray& ray, const std::vector<Prim>& ordered_prims) const {
+    auto hit = Hit::none();
+    std::stack<Index> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        auto node_index = stack.top();
+        auto& node = nodes[node_index];
+        stack.pop();
+        if (!node.intersect(ray))
+            continue;
+
+        if (node.is_leaf()) {
+            // The primitives of the leaf are contiguous in memory
+            for (size_t i = 0; i < node.prim_count; ++i) {
+                if (ordered_prims[node.first_index + i].intersect(ray))
+                    hit.prim_index = node.first_index + i;
+            }
+        } else {
+            stack.push(left_child(node_index));
+            stack.push(right_child(node_index));
+        }
+    }
+    return hit;
+}
+
+template <typename Index>
+static size_t collapse_recursive(
+    const BasicBvh<Index>& bvh,
+    size_t node_index,
+    BasicBvh<Index>& collapsed,
+    size_t collapsed_index,
+    size_t max_prims)
+{
+    auto& node = bvh.nodes[node_index];
+    if (node.is_leaf()) {
+        collapsed.nodes[collapsed_index] = BasicNode<Index>(node.bbox, node.prim_count, collapsed.prim_indices.size());
+        for (size_t i = 0; i < node.prim_count; ++i)
+            collapsed.prim_indices.push_back(bvh.prim_indices[node.first_index + i]);
+        return node.prim_count;
+    }
+
+    auto first_child = collapsed.nodes.size();
+    collapsed.nodes.resize(first_child + 2);
+    auto first_index = collapsed.prim_indices.size();
+    auto prim_count =
+        collapse_recursive(bvh, bvh.left_child(node_index), collapsed, first_child, max_prims) +
+        collapse_recursive(bvh, bvh.right_child(node_index), collapsed, first_child + 1, max_prims);
+
+    // The primitives of the subtree are contiguous, so the children can be replaced by a leaf
+    if (prim_count <= max_prims) {
+        collapsed.nodes.resize(first_child);
+        collapsed.nodes[collapsed_index] = BasicNode<Index>(node.bbox, prim_count, first_index);
+    } else
+        collapsed.nodes[collapsed_index] = BasicNode<Index>(node.bbox, 0, first_child);
+    return prim_count;
+}
+
+template <typename Index>
+void BasicBvh<Index>::collapse_leaves(size_t max_prims) {
+    BasicBvh collapsed;
+    collapsed.nodes.reserve(nodes.size());
+    collapsed.prim_indices.reserve(prim_indices.size());
+    collapsed.nodes.emplace_back();
+    collapse_recursive(*this, 0, collapsed, 0, max_prims);
+    std::swap(nodes, collapsed.nodes);
+    std::swap(prim_indices, collapsed.prim_indices);
+    layout = Layout::SiblingPairs;
+    skip_indices.clear();
+}
+
+template <typename Index>
+template <typename Block, typename T>
+std::vector<Block> BasicBvh<Index>::pack_leaves(const std::vector<T>& prims) {
+    std::vector<Block> blocks;
+    std::vector<Index> block_prim_indices;
+    for (auto& node : nodes) {
+        if (!node.is_leaf())
+            continue;
+        auto first_block = blocks.size();
+        for (size_t i = 0; i < node.prim_count; i += Block::size) {
+            auto& block = blocks.emplace_back();
+            for (size_t j = 0; j < Block::size; ++j) {
+                auto prim_index = i + j < node.prim_count
+                    ? prim_indices[node.first_index + i + j] : static_cast<Index>(-1);
+                if (prim_index != static_cast<Index>(-1))
+                    block.set_triangle(j, prims[prim_index]);
+                block_prim_indices.push_back(prim_index);
+            }
+        }
+        node.first_index = first_block;
+    }
+    std::swap(prim_indices, block_prim_indices);
+    return blocks;
+}
+
+template <typename Index>
+template <typename Block>
+BasicHit<Index> BasicBvh<Index>::traverse_blocks(Ray& ray, const std::vector<Block>& blocks) const {
+    auto hit = Hit::none();
+    std::stack<Index> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        auto node_index = stack.top();
+        auto& node = nodes[node_index];
+        stack.pop();
+        if (!node.intersect(ray))
+            continue;
+
+        if (node.is_leaf()) {
+            auto block_count = (node.prim_count + Block::size - 1) / Block::size;
+            for (size_t i = 0; i < block_count; ++i) {
+                auto block_index = node.first_index + i;
+                auto lane = blocks[block_index].intersect(ray);
+                if (lane >= 0)
+                    hit.prim_index = prim_indices[block_index * Block::size + lane];
+            }
+        } else {
+            stack.push(left_child(node_index));
+            stack.push(right_child(node_index));
+        }
+    }
+    return hit;
+}
+
+template <typename Index>
+static void order_depth_first(const BasicBvh<Index>& bvh, size_t node_index, std::vector<size_t>& order) {
+    order.push_back(node_index);
+    if (!bvh.nodes[node_index].is_leaf()) {
+        order_depth_first(bvh, bvh.left_child(node_index), order);
+        order_depth_first(bvh, bvh.right_child(node_index), order);
+    }
+}
+
+// Sibling pairs are identified by the index of their parent. The pairs at the root of the bottom
+// subtrees are collected in `bottoms`, when it is not null.
+template <typename Index>
+static void order_van_emde_boas(
+    const BasicBvh<Index>& bvh,
+    size_t parent_index,
+    size_t height,
+    std::vector<size_t>& order,
+    std::vector<size_t>* bottoms)
+{
+    if (height == 1) {
+        order.push_back(parent_index);
+        if (bottoms) {
+            for (auto child_index : { bvh.left_child(parent_index), bvh.right_child(parent_index) }) {
+                if (!bvh.nodes[child_index].is_leaf())
+                    bottoms->push_back(child_index);
+            }
+        }
+        return;
+    }
+
+    // Lay out the top half of the tree, followed by each of the bottom subtrees
+    size_t bottom_height = height / 2;
+    std::vector<size_t> top_bottoms;
+    order_van_emde_boas(bvh, parent_index, height - bottom_height, order, &top_bottoms);
+    for (auto bottom_index : top_bottoms)
+        order_van_emde_boas(bvh, bottom_index, bottom_height, order, bottoms);
+}
+
+template <typename Index>
+void BasicBvh<Index>::reorder(Layout new_layout) {
+    // Compute the new position of every node
+    std::vector<size_t> order;
+    order.reserve(nodes.size());
+    if (new_layout == Layout::DepthFirst)
+        order_depth_first(*this, 0, order);
+    else {
+        std::vector<size_t> pairs;
+        if (!nodes[0].is_leaf()) {
+            if (new_layout == Layout::VanEmdeBoas)
+                order_van_emde_boas(*this, 0, depth() - 1, pairs, nullptr);
+            else {
+                order_depth_first(*this, 0, pairs);
+                pairs.erase(std::remove_if(pairs.begin(), pairs.end(),
+                    [&] (size_t i) { return nodes[i].is_leaf(); }), pairs.end());
+            }
+        }
+        order.push_back(0);
+        for (auto parent_index : pairs) {
+            order.push_back(left_child(parent_index));
+            order.push_back(right_child(parent_index));
+        }
+    }
+    assert(order.size() == nodes.size());
+
+    std::vector<size_t> new_indices(nodes.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        new_indices[order[i]] = i;
+
+    std::vector<Node> new_nodes(nodes.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        auto& node = new_nodes[i] = nodes[order[i]];
+        if (!node.is_leaf()) {
+            node.first_index = new_layout == Layout::DepthFirst
+                ? new_indices[right_child(order[i])]
+                : new_indices[left_child(order[i])];
+        }
+    }
+
+    std::swap(nodes, new_nodes);
+    layout = new_layout;
+    skip_indices.clear();
+}
+
+template <typename Index>
+void BasicBvh<Index>::compute_skip_indices() {
+    if (layout != Layout::DepthFirst)
+        reorder(Layout::DepthFirst);
+
+    // Children come after their parent, so subtree sizes can be computed in reverse order
+    std::vector<Index> subtree_sizes(nodes.size());
+    skip_indices.resize(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;) {
+        subtree_sizes[i] = nodes[i].is_leaf()
+            ? 1 : 1 + subtree_sizes[left_child(i)] + subtree_sizes[right_child(i)];
+        skip_indices[i] = i + subtree_sizes[i];
+    }
+}
+
+// Traversal that does not need a stack, using the skip links of the depth-first layout: The next
+// node is the left child when the current node is an inner node that is hit, and the node that
+// follows the subtree of the current node otherwise.
+template <typename Index>
+template <typename Prim>
+BasicHit<Index> BasicBvh<Index>::traverse_stackless(Ray& ray, const std::vector<Prim>& prims) const {
+    assert(layout == Layout::DepthFirst && skip_indices.size() == nodes.size());
+    auto hit = Hit::none();
+    auto inv_dir = ray.inv_dir();
+    size_t node_index = 0;
+    while (node_index < nodes.size()) {
+        auto& node = nodes[node_index];
+        if (!Node::intersect(node.bbox, ray, inv_dir)) {
+            node_index = skip_indices[node_index];
+            continue;
+        }
+
+        if (node.is_leaf()) {
+            for (size_t i = 0; i < node.prim_count; ++i) {
+                auto prim_index = prim_indices[node.first_index + i];
+                if (prims[prim_index].intersect(ray))
+                    hit.prim_index = prim_index;
+            }
+            node_index = skip_indices[node_index];
+        } else
+            node_index = left_child(node_index);
+    }
+    return hit;
+}
+
+// Compressed 8-wide node in the style of "Efficient Incoherent Ray Traversal on GPUs Through
+// Compressed Wide BVHs", by H. Ylitie et al. The bounding boxes of the children are stored as
+// 8-bit offsets on a grid local to the node, whose cell size is a power of two on each axis.
+struct QuantizedNode {
+    static constexpr size_t arity = 8;
+    static constexpr uint8_t inner_child = 0x80;
+    // Subtrees with at most this many primitives are stored as a single leaf
+    static constexpr size_t max_merged_prims = 4;
+
+    Vec3 origin;
+    int8_t exponents[3];
+    uint8_t padding;
+    uint32_t first_child; // Index of the first inner child, the others follow
+    uint32_t first_index; // Index of the first primitive of the first leaf, the others follow
+    uint8_t meta[arity];  // 0 for empty slots, `inner_child` for inner nodes, the primitive count for leaves
+    uint8_t lo[3][arity];
+    uint8_t hi[3][arity];
+
+    bool is_empty(size_t i) const { return meta[i] == 0; }
+    bool is_leaf(size_t i) const { return meta[i] != inner_child; }
+    size_t prim_count(size_t i) const { return meta[i]; }
+
+    static float scale(int8_t exponent) {
+        // The exponent is assumed to be in the range of normalized numbers
+        uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+        float f;
+        std::memcpy(&f, &bits, sizeof(float));
+        return f;
+    }
+
+    float dequantize(int axis, uint8_t q) const {
+        return origin[axis] + static_cast<float>(q) * scale(exponents[axis]);
+    }
+
+    BBox child_bbox(size_t i) const {
+        return BBox(
+            Vec3(dequantize(0, lo[0][i]), dequantize(1, lo[1][i]), dequantize(2, lo[2][i])),
+            Vec3(dequantize(0, hi[0][i]), dequantize(1, hi[1][i]), dequantize(2, hi[2][i])));
+    }
+
+    Node::Intersection intersect(size_t i, const Ray& ray, const Vec3& inv_dir) const {
+        return Node::intersect(child_bbox(i), ray, inv_dir);
+    }
+};
+
+struct QuantizedBvh {
+    std::vector<QuantizedNode> nodes;
+    std::vector<uint32_t> prim_indices;
+
+    QuantizedBvh() = default;
+
+    static QuantizedBvh build(const Bvh& bvh);
+
+    template <typename Prim>
+    Hit traverse(Ray& ray, const std::vector<Prim>& prims) const;
+};
+
+// Counts the primitives in each subtree
+static size_t count_prims(const Bvh& bvh, size_t node_index, std::vector<size_t>& prim_counts) {
+    auto& node = bvh.nodes[node_index];
+    prim_counts[node_index] = node.is_leaf()
+        ? node.prim_count
+        : count_prims(bvh, bvh.left_child(node_index), prim_counts) +
+          count_prims(bvh, bvh.right_child(node_index), prim_counts);
+    return prim_counts[node_index];
+}
+
+static void collect_prims(const Bvh& bvh, size_t node_index, std::vector<uint32_t>& prim_indices) {
+    auto& node = bvh.nodes[node_index];
+    if (node.is_leaf()) {
+        for (size_t i = 0; i < node.prim_count; ++i)
+            prim_indices.push_back(bvh.prim_indices[node.first_index + i]);
+    } else {
+        collect_prims(bvh, bvh.left_child(node_index), prim_indices);
+        collect_prims(bvh, bvh.right_child(node_index), prim_indices);
+    }
+}
+
+static void quantize_recursive(
+    QuantizedBvh& qbvh,
+    size_t qnode_index,
+    const Bvh& bvh,
+    const std::vector<size_t>& prim_counts,
+    size_t node_index)
+{
+    // Small subtrees become leaves: Given their size, a wide node of their own would be mostly empty
+    auto is_leaf = [&] (size_t i) {
+        return bvh.nodes[i].is_leaf() || prim_counts[i] <= QuantizedNode::max_merged_prims;
+    };
+
+    // Collapse the binary tree by repeatedly opening the inner child with the largest area
+    std::vector<size_t> children;
+    if (bvh.nodes[node_index].is_leaf())
+        children.push_back(node_index);
+    else {
+        children.push_back(bvh.left_child(node_index));
+        children.push_back(bvh.right_child(node_index));
+    }
+    while (children.size() < QuantizedNode::arity) {
+        size_t best_child = children.size();
+        float best_area = -std::numeric_limits<float>::max();
+        for (size_t i = 0; i < children.size(); ++i) {
+            auto& child = bvh.nodes[children[i]];
+            if (!is_leaf(children[i]) && child.bbox.half_area() > best_area) {
+                best_child = i;
+                best_area = child.bbox.half_area();
+            }
+        }
+        if (best_child == children.size())
+            break;
+        auto opened_index = children[best_child];
+        children[best_child] = bvh.left_child(opened_index);
+        children.insert(children.begin() + best_child + 1, bvh.right_child(opened_index));
+    }
+
+    auto bbox = BBox::empty();
+    for (auto child : children)
+        bbox.extend(bvh.nodes[child].bbox);
+
+    QuantizedNode qnode;
+    qnode.origin = bbox.min;
+    qnode.padding = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        // Find the smallest power of two such that the grid covers the node
+        auto extent = bbox.max[axis] - bbox.min[axis];
+        int exponent = extent > 0 ? static_cast<int>(std::ceil(std::log2(extent / 255.0f))) : -126;
+        exponent = std::max(exponent, -126);
+        qnode.exponents[axis] = exponent;
+        while (qnode.dequantize(axis, 255) < bbox.max[axis]) {
+            assert(exponent < 127);
+            qnode.exponents[axis] = ++exponent;
+        }
+    }
+
+    size_t inner_count = 0;
+    qnode.first_child = qbvh.nodes.size();
+    qnode.first_index = qbvh.prim_indices.size();
+    for (size_t i = 0; i < QuantizedNode::arity; ++i) {
+        if (i >= children.size()) {
+            qnode.meta[i] = 0;
+            for (int axis = 0; axis < 3; ++axis)
+                qnode.lo[axis][i] = qnode.hi[axis][i] = 0;
+            continue;
+        }
+
+        auto& child = bvh.nodes[children[i]];
+        for (int axis = 0; axis < 3; ++axis) {
+            // Rounding is conservative: The dequantized box always contains the original one
+            auto inv_scale = 1.0f / QuantizedNode::scale(qnode.exponents[axis]);
+            auto lo = std::floor((child.bbox.min[axis] - qnode.origin[axis]) * inv_scale);
+            auto hi = std::ceil ((child.bbox.max[axis] - qnode.origin[axis]) * inv_scale);
+            qnode.lo[axis][i] = static_cast<uint8_t>(std::clamp(lo, 0.0f, 255.0f));
+            qnode.hi[axis][i] = static_cast<uint8_t>(std::clamp(hi, 0.0f, 255.0f));
+            while (qnode.lo[axis][i] > 0 && qnode.dequantize(axis, qnode.lo[axis][i]) > child.bbox.min[axis])
+                qnode.lo[axis][i]--;
+            while (qnode.hi[axis][i] < 255 && qnode.dequantize(axis, qnode.hi[axis][i]) < child.bbox.max[axis])
+                qnode.hi[axis][i]++;
+        }
+
+        if (is_leaf(children[i])) {
+            assert(prim_counts[children[i]] < QuantizedNode::inner_child);
+            qnode.meta[i] = prim_counts[children[i]];
+            collect_prims(bvh, children[i], qbvh.prim_indices);
+        } else {
+            qnode.meta[i] = QuantizedNode::inner_child;
+            inner_count++;
+        }
+    }
+
+    // Inner children are allocated contiguously, and then processed recursively
+    qbvh.nodes[qnode_index] = qnode;
+    qbvh.nodes.resize(qbvh.nodes.size() + inner_count);
+    auto child_index = qnode.first_child;
+    for (size_t i = 0; i < children.size(); ++i) {
+        if (!qnode.is_leaf(i))
+            quantize_recursive(qbvh, child_index++, bvh, prim_counts, children[i]);
+    }
+}
+
+inline QuantizedBvh QuantizedBvh::build(const Bvh& bvh) {
+    QuantizedBvh qbvh;
+    std::vector<size_t> prim_counts(bvh.nodes.size());
+    count_prims(bvh, 0, prim_counts);
+    qbvh.prim_indices.reserve(bvh.prim_indices.size());
+    qbvh.nodes.resize(1);
+    quantize_recursive(qbvh, 0, bvh, prim_counts, 0);
+    return qbvh;
+}
+
+template <typename Prim>
+Hit QuantizedBvh::traverse(Ray& ray, const std::vector<Prim>& prims) const {
+    auto hit = Hit::none();
+    auto inv_dir = ray.inv_dir();
+    std::stack<uint32_t> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        auto& node = nodes[stack.top()];
+        stack.pop();
+
+        auto child_index = node.first_child;
+        auto first_index = node.first_index;
+        for (size_t i = 0; i < QuantizedNode::arity && !node.is_empty(i); ++i) {
+            bool is_leaf = node.is_leaf(i);
+            if (node.intersect(i, ray, inv_dir)) {
+                if (is_leaf) {
+                    for (size_t j = 0; j < node.prim_count(i); ++j) {
+                        auto prim_index = prim_indices[first_index + j];
+                        if (prims[prim_index].intersect(ray))
+                            hit.prim_index = prim_index;
+                    }
+                } else
+                    stack.push(child_index);
+            }
+            if (is_leaf)
+                first_index += node.prim_count(i);
+            else
+                child_index++;
+        }
+    }
+    return hit;
+}
+
+// Binary node that stores the bounding boxes of its two children, instead of its own. Deciding
+// which children to visit only requires fetching the parent, which fits in a cache line.
+struct alignas(64) PairedNode {
+    BBox bboxes[2];
+    uint32_t prim_counts[2];
+    uint32_t first_indices[2];
+
+    // The root cannot be the child of another node, which is used to mark empty slots
+    bool is_empty(size_t i) const { return prim_counts[i] == 0 && first_indices[i] == 0; }
+    bool is_leaf(size_t i) const { return prim_counts[i] != 0; }
+};
+
+struct PairedBvh {
+    std::vector<PairedNode> nodes;
+    std::vector<uint32_t> prim_indices;
+
+    PairedBvh() = default;
+
+    static PairedBvh build(const Bvh& bvh);
+
+    template <typename Prim>
+    Hit traverse(Ray& ray, const std::vector<Prim>& prims) const;
+};
+
+static void pair_recursive(
+    PairedBvh& pbvh,
+    size_t pnode_index,
+    const Bvh& bvh,
+    size_t node_index)
+{
+    size_t child_indices[2] = { bvh.left_child(node_index), bvh.right_child(node_index) };
+    for (size_t i = 0; i < 2; ++i) {
+        auto& child = bvh.nodes[child_indices[i]];
+        auto& pnode = pbvh.nodes[pnode_index];
+        pnode.bboxes[i] = child.bbox;
+        pnode.prim_counts[i] = child.prim_count;
+        if (child.is_leaf())
+            pnode.first_indices[i] = child.first_index;
+        else {
+            // The reference to the current node is invalidated when the array grows
+            auto first_index = pbvh.nodes.size();
+            pnode.first_indices[i] = first_index;
+            pbvh.nodes.emplace_back();
+            pair_recursive(pbvh, first_index, bvh, child_indices[i]);
+        }
+    }
+}
+
+inline PairedBvh PairedBvh::build(const Bvh& bvh) {
+    PairedBvh pbvh;
+    pbvh.prim_indices = bvh.prim_indices;
+    pbvh.nodes.reserve(bvh.nodes.size() / 2 + 1);
+    pbvh.nodes.emplace_back();
+    auto& root = bvh.nodes[0];
+    if (root.is_leaf()) {
+        // The root is stored in the first slot, and the second one is left empty
+        auto& pnode = pbvh.nodes[0];
+        pnode.bboxes[0] = root.bbox;
+        pnode.bboxes[1] = BBox::empty();
+        pnode.prim_counts[0] = root.prim_count;
+        pnode.prim_counts[1] = 0;
+        pnode.first_indices[0] = root.first_index;
+        pnode.first_indices[1] = 0;
+    } else
+        pair_recursive(pbvh, 0, bvh, 0);
+    return pbvh;
+}
+
+template <typename Prim>
+Hit PairedBvh::traverse(Ray& ray, const std::vector<Prim>& prims) const {
+    auto hit = Hit::none();
+    auto inv_dir = ray.inv_dir();
+    std::stack<uint32_t> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        auto& node = nodes[stack.top()];
+        stack.pop();
+        for (size_t i = 0; i < 2; ++i) {
+            if (node.is_empty(i) || !Node::intersect(node.bboxes[i], ray, inv_dir))
+                continue;
+
+            if (node.is_leaf(i)) {
+                for (size_t j = 0; j < node.prim_counts[i]; ++j) {
+                    auto prim_index = prim_indices[node.first_indices[i] + j];
+                    if (prims[prim_index].intersect(ray))
+                        hit.prim_index = prim_index;
+                }
+            } else
+                stack.push(node.first_indices[i]);
+        }
+    }
+    return hit;
+}
+
+// Calls `f(i)` for every `i` in `[0, count)`, each on its own thread
+template <typename F>
+void parallel_for(size_t count, F&& f) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < count; ++i)
+        threads.emplace_back([&f, i] { f(i); });
+    if (count > 0)
+        f(0);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+inline size_t thread_count() {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// Fills the bounding boxes and centers of the triangles in the given range, and returns the bounding
+// box of their centers
+inline BBox fill_build_input(const Mesh& mesh, size_t begin, size_t end, BuildInput& input) {
+    auto center_bbox = BBox::empty();
+    for (size_t i = begin; i < end; ++i) {
+        input.bboxes[i] = mesh.bbox(i);
+        input.centers[i] = mesh.center(i);
+        center_bbox.extend(input.centers[i]);
+    }
+    return center_bbox;
+}
+
+// Merges the bounding boxes of the centers of every range, and computes the Morton codes if needed
+inline void finish_build_input(BuildInput& input, const std::vector<size_t>& offsets, const std::vector<BBox>& center_bboxes) {
+    for (auto& center_bbox : center_bboxes)
+        input.center_bbox.extend(center_bbox);
+    if (input.with_mortons)
+        parallel_for(center_bboxes.size(), [&] (size_t i) { input.compute_mortons(offsets[i], offsets[i + 1]); });
+}
+
+// Computes the inputs of the builders for a mesh that has not been produced by one of the loaders
+inline void compute_build_input(const Mesh& mesh, BuildInput& input) {
+    size_t range_count = std::max(std::min(thread_count(), mesh.triangle_count()), size_t(1));
+    std::vector<size_t> offsets(range_count + 1);
+    for (size_t i = 0; i <= range_count; ++i)
+        offsets[i] = i * mesh.triangle_count() / range_count;
+    std::vector<BBox> center_bboxes(range_count);
+    input.resize(mesh.triangle_count());
+    parallel_for(range_count, [&] (size_t i) {
+        center_bboxes[i] = fill_build_input(mesh, offsets[i], offsets[i + 1], input);
+    });
+    finish_build_input(input, offsets, center_bboxes);
+}
+
+// Sorts the given range in parallel, by sorting one part per thread and then merging the parts
+template <typename T, typename Compare>
+void parallel_sort(std::vector<T>& values, Compare compare) {
+    size_t part_count = std::max(std::min(thread_count(), values.size()), size_t(1));
+    std::vector<size_t> offsets(part_count + 1);
+    for (size_t i = 0; i <= part_count; ++i)
+        offsets[i] = i * values.size() / part_count;
+    parallel_for(part_count, [&] (size_t i) {
+        std::sort(values.begin() + offsets[i], values.begin() + offsets[i + 1], compare);
+    });
+    for (size_t step = 1; step < part_count; step *= 2) {
+        for (size_t i = 0; i + step < part_count; i += 2 * step) {
+            std::inplace_merge(
+                values.begin() + offsets[i],
+                values.begin() + offsets[i + step],
+                values.begin() + offsets[std::min(i + 2 * step, part_count)], compare);
+        }
+    }
+}
+
+// Concatenates the given meshes, in order, into a single mesh
+inline Mesh merge_meshes(std::vector<Mesh>& meshes) {
+    std::vector<size_t> vertex_offsets(meshes.size() + 1, 0);
+    std::vector<size_t> index_offsets(meshes.size() + 1, 0);
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        vertex_offsets[i + 1] = vertex_offsets[i] + meshes[i].vertices.size();
+        index_offsets[i + 1] = index_offsets[i] + meshes[i].indices.size();
+    }
+
+    Mesh mesh;
+    mesh.vertices.resize(vertex_offsets.back());
+    mesh.indices.resize(index_offsets.back());
+    size_t range_count = std::max(std::min(thread_count(), meshes.size()), size_t(1));
+    parallel_for(range_count, [&] (size_t i) {
+        for (size_t j = i * meshes.size() / range_count, n = (i + 1) * meshes.size() / range_count; j < n; ++j) {
+            std::copy(meshes[j].vertices.begin(), meshes[j].vertices.end(), mesh.vertices.begin() + vertex_offsets[j]);
+            std::transform(
+                meshes[j].indices.begin(), meshes[j].indices.end(), mesh.indices.begin() + index_offsets[j],
+                [&] (uint32_t index) { return static_cast<uint32_t>(index + vertex_offsets[j]); });
+            meshes[j] = Mesh();
+        }
+    });
+    return mesh;
+}
+
+struct WeldResult {
+    size_t removed_vertices;
+    size_t removed_triangles;
+};
+
+// Merges the vertices that are closer than the given tolerance, or identical when the tolerance is
+// zero, and removes the triangles that become degenerate. Vertices are sorted by the hash of their
+// cell on a grid whose cell size is the tolerance, so that the vertices of a cell are contiguous
+// and can be found with a hash table lookup. Each vertex is merged with the vertex of lowest index
+// among those within the tolerance in the neighboring cells.
+inline WeldResult weld_vertices(Mesh& mesh, float tolerance) {
+    using Cell = std::array<int64_t, 3>;
+    auto cell_of = [&] (const Vec3& p) {
+        Cell cell;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (tolerance > 0) {
+                // Clamping keeps the conversion defined for tiny tolerances, and distances are
+                // checked anyway
+                static constexpr float max_coord = 4611686018427387904.0f; // 2^62
+                cell[axis] = static_cast<int64_t>(std::clamp(std::floor(p[axis] / tolerance), -max_coord, max_coord));
+            }
+            else {
+                // Adding zero turns negative zeros into positive zeros
+                float value = p[axis] + 0.0f;
+                uint32_t bits;
+                std::memcpy(&bits, &value, sizeof(float));
+                cell[axis] = bits;
+            }
+        }
+        return cell;
+    };
+    auto hash = [] (const Cell& cell) {
+        uint64_t h = 0;
+        for (auto coord : cell)
+            h = (h ^ static_cast<uint64_t>(coord)) * 0x9e3779b97f4a7c15;
+        return h ^ (h >> 32);
+    };
+    auto is_close = [&] (const Vec3& a, const Vec3& b) {
+        auto d = a - b;
+        return tolerance > 0 ? dot(d, d) <= tolerance * tolerance : d[0] == 0 && d[1] == 0 && d[2] == 0;
+    };
+
+    auto vertex_count = mesh.vertices.size();
+    size_t range_count = std::max(std::min(thread_count(), vertex_count), size_t(1));
+    auto range_begin = [&] (size_t i, size_t count) { return i * count / range_count; };
+
+    std::vector<std::pair<uint64_t, uint32_t>> grid(vertex_count);
+    parallel_for(range_count, [&] (size_t i) {
+        for (size_t j = range_begin(i, vertex_count), n = range_begin(i + 1, vertex_count); j < n; ++j)
+            grid[j] = std::make_pair(hash(cell_of(mesh.vertices[j])), static_cast<uint32_t>(j));
+    });
+    parallel_sort(grid, [] (auto& a, auto& b) { return a < b; });
+
+    // Hash table with open addressing that gives the first vertex of each cell in the grid
+    static constexpr uint32_t empty_slot = std::numeric_limits<uint32_t>::max();
+    size_t table_size = 1;
+    while (table_size < 2 * vertex_count)
+        table_size *= 2;
+    std::vector<std::pair<uint64_t, uint32_t>> table(table_size, std::make_pair(uint64_t(0), empty_slot));
+    for (size_t i = 0; i < vertex_count; ++i) {
+        if (i > 0 && grid[i].first == grid[i - 1].first)
+            continue;
+        auto slot = grid[i].first & (table_size - 1);
+        while (table[slot].second != empty_slot)
+            slot = (slot + 1) & (table_size - 1);
+        table[slot] = std::make_pair(grid[i].first, static_cast<uint32_t>(i));
+    }
+    auto find_cell = [&] (uint64_t key) {
+        for (auto slot = key & (table_size - 1); table[slot].second != empty_slot; slot = (slot + 1) & (table_size - 1)) {
+            if (table[slot].first == key)
+                return grid.begin() + table[slot].second;
+        }
+        return grid.end();
+    };
+
+    // Every vertex is mapped to a vertex of lower or equal index. Vertices are processed in the order
+    // of the grid, so that consecutive searches look at nearby locations.
+    std::vector<uint32_t> remap(vertex_count);
+    int64_t neighbors = tolerance > 0 ? 1 : 0;
+    parallel_for(range_count, [&] (size_t i) {
+        for (size_t k = range_begin(i, vertex_count), n = range_begin(i + 1, vertex_count); k < n; ++k) {
+            auto j = grid[k].second;
+            auto& vertex = mesh.vertices[j];
+            auto cell = cell_of(vertex);
+            auto closest = static_cast<uint32_t>(j);
+            for (int64_t x = -neighbors; x <= neighbors; ++x) {
+                for (int64_t y = -neighbors; y <= neighbors; ++y) {
+                    for (int64_t z = -neighbors; z <= neighbors; ++z) {
+                        auto key = hash(Cell { cell[0] + x, cell[1] + y, cell[2] + z });
+                        auto it = find_cell(key);
+                        for (; it != grid.end() && it->first == key && it->second < closest; ++it) {
+                            if (is_close(mesh.vertices[it->second], vertex))
+                                closest = it->second;
+                        }
+                    }
+                }
+            }
+            remap[j] = closest;
+        }
+    });
+    grid = {};
+    table = {};
+
+    // Follow chains of merged vertices, and number the remaining vertices in order
+    std::vector<Vec3> vertices;
+    for (size_t i = 0; i < vertex_count; ++i) {
+        if (remap[i] == i) {
+            remap[i] = vertices.size();
+            vertices.push_back(mesh.vertices[i]);
+        } else
+            remap[i] = remap[remap[i]];
+    }
+
+    // Remap the triangles and remove those that have a zero area, keeping the order of the others
+    auto triangle_count = mesh.triangle_count();
+    std::vector<size_t> kept_counts(range_count + 1, 0);
+    std::vector<uint32_t> indices(mesh.indices.size());
+    parallel_for(range_count, [&] (size_t i) {
+        size_t kept = range_begin(i, triangle_count);
+        for (size_t j = range_begin(i, triangle_count), n = range_begin(i + 1, triangle_count); j < n; ++j) {
+            uint32_t triangle[3];
+            for (size_t k = 0; k < 3; ++k)
+                triangle[k] = remap[mesh.indices[3 * j + k]];
+            // Triangles whose vertices were merged are removed by comparing indices, since the area
+            // computed for them is not always exactly zero once the compiler contracts it into FMAs
+            if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0])
+                continue;
+            auto normal = cross(vertices[triangle[1]] - vertices[triangle[0]], vertices[triangle[2]] - vertices[triangle[0]]);
+            if (dot(normal, normal) == 0)
+                continue;
+            std::copy(triangle, triangle + 3, indices.begin() + 3 * kept++);
+        }
+        kept_counts[i + 1] = kept - range_begin(i, triangle_count);
+    });
+    for (size_t i = 0; i < range_count; ++i) {
+        auto first = indices.begin() + 3 * range_begin(i, triangle_count);
+        std::copy(first, first + 3 * kept_counts[i + 1], indices.begin() + 3 * kept_counts[i]);
+        kept_counts[i + 1] += kept_counts[i];
+    }
+    indices.resize(3 * kept_counts.back());
+
+    WeldResult result { vertex_count - vertices.size(), triangle_count - indices.size() / 3 };
+    mesh.vertices = std::move(vertices);
+    mesh.indices = std::move(indices);
+    return result;
+}
+
+// Memory-mapped view of a file, which is unmapped when this object is destroyed
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) { swap(other); }
+    ~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    MappedFile& operator = (MappedFile other) { swap(other); return *this; }
+
+    // Returns an empty object if the file cannot be mapped, or if the platform does not support it
+    static MappedFile map(const std::string& file) {
+        MappedFile mapped_file;
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+            return mapped_file;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto size = static_cast<size_t>(info.st_size);
+            auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, size, MADV_SEQUENTIAL);
+                mapped_file.data_ = static_cast<const char*>(data);
+                mapped_file.size_ = size;
+            }
+        }
+        close(fd);
+#else
+        (void)file;
+#endif
+        return mapped_file;
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    operator bool () const { return data_ != nullptr; }
+
+private:
+    void swap(MappedFile& other) {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Returns true if the file is a regular file that can be opened for reading
+inline bool is_readable_file(const std::string& file) {
+    std::error_code error;
+    return std::filesystem::is_regular_file(file, error) && std::ifstream(file, std::ifstream::binary);
+}
+
+// Creates an empty file whose name starts with the given prefix and is not used by any other file,
+// and returns that name. Files written this way can then be renamed to publish them atomically.
+inline std::optional<std::string> create_temp_file(const std::string& prefix) {
+#if defined(__unix__) || defined(__APPLE__)
+    auto name = prefix + ".XXXXXX";
+    int fd = mkstemp(name.data());
+    if (fd < 0)
+        return std::nullopt;
+    // mkstemp() restricts the permissions to the owner, which is not needed for these files
+    fchmod(fd, 0644);
+    close(fd);
+    return std::make_optional(name);
+#else
+    // Without mkstemp(), the name is made unique with random numbers, which is good enough here
+    std::random_device device;
+    auto name = prefix + "." + std::to_string(device()) + std::to_string(device());
+    if (!std::ofstream(name, std::ofstream::binary))
+        return std::nullopt;
+    return std::make_optional(name);
+#endif
+}
+
+#if defined(BVH_HAS_IO_URING)
+// Submission and completion queues of io_uring, set up with raw system calls to avoid depending on
+// liburing. Only reads are supported, and the queues are meant to be used from a single thread.
+class IoRing {
+public:
+    IoRing() = default;
+    IoRing(const IoRing&) = delete;
+    IoRing(IoRing&& other) { swap(other); }
+    ~IoRing() {
+        if (sqes_)
+            munmap(sqes_, sqe_count_ * sizeof(io_uring_sqe));
+        if (cq_ring_ && cq_ring_ != sq_ring_)
+            munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_)
+            munmap(sq_ring_, sq_ring_size_);
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    IoRing& operator = (IoRing other) { swap(other); return *this; }
+
+    // Returns an empty object if the kernel does not support io_uring, or does not allow it
+    static IoRing create(unsigned entry_count) {
+        IoRing ring;
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring.fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entry_count, &params));
+        if (ring.fd_ < 0)
+            return IoRing();
+
+        ring.sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring.cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            ring.sq_ring_size_ = ring.cq_ring_size_ = std::max(ring.sq_ring_size_, ring.cq_ring_size_);
+        auto map_ring = [&] (size_t size, off_t offset) -> char* {
+            auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd_, offset);
+            return data != MAP_FAILED ? static_cast<char*>(data) : nullptr;
+        };
+        if (!(ring.sq_ring_ = map_ring(ring.sq_ring_size_, IORING_OFF_SQ_RING)))
+            return IoRing();
+        ring.cq_ring_ = single_mmap ? ring.sq_ring_ : map_ring(ring.cq_ring_size_, IORING_OFF_CQ_RING);
+        if (!ring.cq_ring_)
+            return IoRing();
+        ring.sqe_count_ = params.sq_entries;
+        ring.sqes_ = reinterpret_cast<io_uring_sqe*>(map_ring(ring.sqe_count_ * sizeof(io_uring_sqe), IORING_OFF_SQES));
+        if (!ring.sqes_)
+            return IoRing();
+
+        ring.sq_head_  = reinterpret_cast<unsigned*>(ring.sq_ring_ + params.sq_off.head);
+        ring.sq_tail_  = reinterpret_cast<unsigned*>(ring.sq_ring_ + params.sq_off.tail);
+        ring.sq_mask_  = *reinterpret_cast<unsigned*>(ring.sq_ring_ + params.sq_off.ring_mask);
+        ring.sq_array_ = reinterpret_cast<unsigned*>(ring.sq_ring_ + params.sq_off.array);
+        ring.cq_head_  = reinterpret_cast<unsigned*>(ring.cq_ring_ + params.cq_off.head);
+        ring.cq_tail_  = reinterpret_cast<unsigned*>(ring.cq_ring_ + params.cq_off.tail);
+        ring.cq_mask_  = *reinterpret_cast<unsigned*>(ring.cq_ring_ + params.cq_off.ring_mask);
+        ring.cqes_     = reinterpret_cast<io_uring_cqe*>(ring.cq_ring_ + params.cq_off.cqes);
+        return ring;
+    }
+
+    // Number of requests that can be in flight at the same time
+    size_t capacity() const { return sqe_count_; }
+
+    // Queues a read, which is only sent to the kernel by the next call to `submit_and_wait()`
+    bool read(int fd, char* data, size_t size, uint64_t offset, uint64_t user_data) {
+        auto tail = *sq_tail_;
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sqe_count_)
+            return false;
+        auto index = tail & sq_mask_;
+        auto& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(data);
+        sqe.len = static_cast<uint32_t>(size);
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        queued_count_++;
+        return true;
+    }
+
+    // Submits the queued requests, and waits until at least the given number of requests complete
+    bool submit_and_wait(unsigned wait_count) {
+        while (true) {
+            auto result = syscall(__NR_io_uring_enter, fd_, queued_count_, wait_count, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result >= 0) {
+                queued_count_ -= static_cast<unsigned>(result);
+                return true;
+            }
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    // Calls `f(user_data, result)` for every completed request
+    template <typename F>
+    void for_each_completion(F&& f) {
+        auto head = *cq_head_;
+        auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            auto& cqe = cqes_[head & cq_mask_];
+            f(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    operator bool () const { return fd_ >= 0; }
+
+private:
+    void swap(IoRing& other) {
+        std::swap(fd_, other.fd_);
+        std::swap(sq_ring_, other.sq_ring_);
+        std::swap(cq_ring_, other.cq_ring_);
+        std::swap(sq_ring_size_, other.sq_ring_size_);
+        std::swap(cq_ring_size_, other.cq_ring_size_);
+        std::swap(sqes_, other.sqes_);
+        std::swap(sqe_count_, other.sqe_count_);
+        std::swap(queued_count_, other.queued_count_);
+        std::swap(sq_head_, other.sq_head_);
+        std::swap(sq_tail_, other.sq_tail_);
+        std::swap(sq_mask_, other.sq_mask_);
+        std::swap(sq_array_, other.sq_array_);
+        std::swap(cq_head_, other.cq_head_);
+        std::swap(cq_tail_, other.cq_tail_);
+        std::swap(cq_mask_, other.cq_mask_);
+        std::swap(cqes_, other.cqes_);
+    }
+
+    int fd_ = -1;
+    char* sq_ring_ = nullptr;
+    char* cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned sqe_count_ = 0;
+    unsigned queued_count_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
+#endif
+
+namespace obj {
+
+// The parsing functions below work on ranges of characters that are not null-terminated, and never
+// read past the end of the range. Lines are never copied.
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline const char* skip_blanks(const char* ptr, const char* end) {
+    while (ptr != end && is_blank(*ptr)) ptr++;
+    return ptr;
+}
+
+inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char* skip_digits(const char* ptr, const char* end) {
+    while (ptr != end && is_digit(*ptr)) ptr++;
+    return ptr;
+}
+
+inline const char* skip_integer(const char* ptr, const char* end) {
+    if (ptr != end && *ptr == '-')
+        ptr++;
+    return skip_digits(ptr, end);
+}
+
+// Numbers with a mantissa that is exactly representable as a float, and a small power of ten, are
+// converted with a single, correctly rounded multiplication or division (see "How to Read Floating
+// Point Numbers Accurately", by W. D. Clinger). This covers the vast majority of the numbers found
+// in OBJ files. Other numbers are converted with `std::from_chars`, or with a stream that uses the
+// classic locale when the standard library does not support `std::from_chars` for floats. All
+// these conversions are locale-independent.
+inline std::optional<float> read_float(const char** ptr, const char* end) {
+    static constexpr float powers_of_ten[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+    static constexpr uint64_t max_exact_mantissa = uint64_t(1) << 24;
+    static constexpr int max_exact_exponent = 10;
+    static constexpr size_t max_digits = 19;
+
+    auto base = skip_blanks(*ptr, end);
+    // `std::from_chars` does not accept a leading plus sign
+    if (base != end && *base == '+')
+        base++;
+
+    auto cur = base;
+    bool negative = cur != end && *cur == '-';
+    if (negative)
+        cur++;
+    uint64_t mantissa = 0;
+    size_t digit_count = 0;
+    int exponent = 0;
+    for (; cur != end && is_digit(*cur); ++cur, ++digit_count)
+        mantissa = mantissa * 10 + (*cur - '0');
+    if (cur != end && *cur == '.') {
+        auto fraction = ++cur;
+        for (; cur != end && is_digit(*cur); ++cur, ++digit_count)
+            mantissa = mantissa * 10 + (*cur - '0');
+        exponent = -static_cast<int>(cur - fraction);
+    }
+    bool has_exponent = cur != end && (*cur == 'e' || *cur == 'E');
+    if (digit_count > 0 && digit_count <= max_digits && !has_exponent &&
+        mantissa <= max_exact_mantissa && exponent >= -max_exact_exponent)
+    {
+        auto value = static_cast<float>(mantissa) / powers_of_ten[-exponent];
+        *ptr = cur;
+        return std::make_optional(negative ? -value : value);
+    }
+
+    float value;
+#if defined(__cpp_lib_to_chars)
+    auto [next, error] = std::from_chars(base, end, value);
+    if (error != std::errc())
+        return std::nullopt;
+#else
+    std::istringstream is(std::string(base, std::find_if(base, end, is_blank)));
+    is.imbue(std::locale::classic());
+    if (!(is >> value))
+        return std::nullopt;
+    auto next = base + (is.eof() ? is.str().size() : static_cast<size_t>(is.tellg()));
+#endif
+    *ptr = next;
+    return std::make_optional(value);
+}
+
+inline std::optional<long> read_integer(const char** ptr, const char* end) {
+    long value;
+    auto [next, error] = std::from_chars(*ptr, end, value);
+    if (error != std::errc())
+        return std::nullopt;
+    *ptr = next;
+    return std::make_optional(value);
+}
+
+inline std::optional<long> read_index(const char** ptr, const char* end) {
+    // Detect end of line (negative indices are supported)
+    auto base = skip_blanks(*ptr, end);
+    auto index = read_integer(&base, end);
+    if (!index)
+        return std::nullopt;
+    base = skip_blanks(base, end);
+
+    // Texture coordinate and normal indices are not needed, and are skipped without being converted
+    if (base != end && *base == '/') {
+        base++;
+
+        // The texture coordinate index may be missing, as in `f 1//1 2//2 3//3`
+        base = skip_integer(base, end);
+        base = skip_blanks(base, end);
+
+        if (base != end && *base == '/') {
+            base++;
+            base = skip_integer(base, end);
+        }
+    }
+
+    *ptr = base;
+    return index;
+}
+
+// Vertices and faces found in a part of the file. Faces are triangulated as a fan, and their indices
+// are kept as they appear in the file, along with the number of vertices that precede them in the
+// part, so that they can be resolved once the number of vertices in the previous parts is known.
+struct Chunk {
+    struct Face {
+        long indices[3];
+        size_t vertex_count;
+    };
+
+    std::vector<Vec3> vertices;
+    std::vector<Face> faces;
+};
+
+inline void parse_chunk(const char* begin, const char* end, Chunk& chunk) {
+    for (const char* line = begin; line != end;) {
+        auto line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        auto next_line = line_end ? line_end + 1 : end;
+        if (!line_end)
+            line_end = end;
+
+        auto ptr = skip_blanks(line, line_end);
+        if (line_end - ptr >= 2 && ptr[0] == 'v' && is_blank(ptr[1])) {
+            ptr += 2;
+            auto x = read_float(&ptr, line_end);
+            auto y = read_float(&ptr, line_end);
+            auto z = read_float(&ptr, line_end);
+            chunk.vertices.emplace_back(x.value_or(0), y.value_or(0), z.value_or(0));
+        } else if (line_end - ptr >= 2 && ptr[0] == 'f' && is_blank(ptr[1])) {
+            Chunk::Face face { {}, chunk.vertices.size() };
+            ptr += 2;
+            for (size_t i = 0; ; ++i) {
+                if (auto index = read_index(&ptr, line_end)) {
+                    if (i >= 2) {
+                        face.indices[2] = *index;
+                        chunk.faces.push_back(face);
+                        face.indices[1] = *index;
+                    } else {
+                        face.indices[i] = *index;
+                    }
+                } else {
+                    break;
+                }
+            }
+        }
+        line = next_line;
+    }
+}
+
+// Splits the input in one part per thread, at line boundaries, and parses the parts in parallel. When
+// given, the inputs of the builders are computed as the triangles are produced.
+inline Mesh load_from_memory(
+    const char* begin, const char* end,
+    BuildInput* input = nullptr,
+    size_t max_chunk_count = thread_count())
+{
+    // Small inputs are not worth the cost of starting threads
+    static constexpr size_t min_chunk_size = 1 << 20;
+    size_t size = end - begin;
+    size_t chunk_count = std::max(std::min(max_chunk_count, size / min_chunk_size), size_t(1));
+
+    std::vector<const char*> bounds(chunk_count + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < chunk_count; ++i) {
+        auto ptr = std::max(begin + i * size / chunk_count, bounds[i - 1]);
+        auto line_end = static_cast<const char*>(std::memchr(ptr, '\n', end - ptr));
+        bounds[i] = line_end ? line_end + 1 : end;
+    }
+
+    std::vector<Chunk> chunks(chunk_count);
+    parallel_for(chunk_count, [&] (size_t i) { parse_chunk(bounds[i], bounds[i + 1], chunks[i]); });
+
+    // Relative indices refer to the vertices of the previous chunks, which are all concatenated
+    std::vector<size_t> vertex_offsets(chunk_count + 1, 0);
+    std::vector<size_t> triangle_offsets(chunk_count + 1, 0);
+    for (size_t i = 0; i < chunk_count; ++i) {
+        vertex_offsets[i + 1] = vertex_offsets[i] + chunks[i].vertices.size();
+        triangle_offsets[i + 1] = triangle_offsets[i] + chunks[i].faces.size();
+    }
+
+    Mesh mesh;
+    mesh.vertices.resize(vertex_offsets.back());
+    mesh.indices.resize(triangle_offsets.back() * 3);
+    parallel_for(chunk_count, [&] (size_t i) {
+        std::copy(chunks[i].vertices.begin(), chunks[i].vertices.end(), mesh.vertices.begin() + vertex_offsets[i]);
+        chunks[i].vertices = std::vector<Vec3>();
+    });
+
+    // Faces may refer to the vertices of any previous chunk, so this needs all the vertices
+    std::vector<BBox> center_bboxes(chunk_count);
+    if (input)
+        input->resize(mesh.triangle_count());
+    parallel_for(chunk_count, [&] (size_t i) {
+        for (size_t j = 0; j < chunks[i].faces.size(); ++j) {
+            auto& face = chunks[i].faces[j];
+            for (size_t k = 0; k < 3; ++k) {
+                auto index = face.indices[k];
+                size_t l = index < 0 ? vertex_offsets[i] + face.vertex_count + index : index - 1;
+                assert(l < vertex_offsets[i] + face.vertex_count);
+                mesh.indices[3 * (triangle_offsets[i] + j) + k] = l;
+            }
+        }
+        chunks[i].faces = std::vector<Chunk::Face>();
+        if (input)
+            center_bboxes[i] = fill_build_input(mesh, triangle_offsets[i], triangle_offsets[i + 1], *input);
+    });
+    if (input)
+        finish_build_input(*input, triangle_offsets, center_bboxes);
+
+    return mesh;
+}
+
+inline Mesh load_from_stream(std::istream& is, BuildInput* input = nullptr) {
+    std::string contents(std::istreambuf_iterator<char>(is), {});
+    return load_from_memory(contents.data(), contents.data() + contents.size(), input);
+}
+
+inline Mesh load_from_file(const std::string& file, BuildInput* input = nullptr) {
+    // Mapping the file avoids copying it, but the stream is used as a fallback
+    if (auto mapped_file = MappedFile::map(file))
+        return load_from_memory(mapped_file.data(), mapped_file.data() + mapped_file.size(), input);
+    std::ifstream is(file, std::ifstream::binary);
+    if (is)
+        return load_from_stream(is, input);
+    return Mesh();
+}
+
+#if defined(BVH_HAS_IO_URING)
+// Reads the files in blocks with many reads in flight, and parses every file on a worker thread as
+// soon as all its blocks have been read, while the next files are being read. The files that cannot
+// be read that way are not marked as loaded.
+inline void load_with_io_ring(const std::vector<std::string>& files, std::vector<Mesh>& meshes, std::vector<char>& loaded) {
+    static constexpr size_t block_size = 1 << 20;
+    static constexpr unsigned queue_depth = 64;
+    // A file is only read when its contents fit in this budget, along with the contents of the files
+    // that are being read or parsed. Larger files are read when no other file is buffered.
+    static constexpr size_t max_buffered_size = size_t(256) << 20;
+
+    auto ring = IoRing::create(queue_depth);
+    if (!ring)
+        return;
+
+    struct File {
+        int fd = -1;
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+        size_t remaining = 0;
+        size_t pending_reads = 0;
+        bool failed = false;
+    };
+    struct Read {
+        size_t file_index;
+        size_t offset;
+        size_t size;
+    };
+    std::vector<File> opened_files(files.size());
+
+    // The workers parse the files that have been read, and release their contents
+    std::mutex mutex;
+    std::condition_variable parse_condition;
+    std::condition_variable release_condition;
+    std::vector<size_t> read_files;
+    size_t buffered_size = 0;
+    size_t parse_count = 0;
+    bool done_reading = false;
+    auto release_file = [&] (File& file) {
+        file.data.reset();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffered_size -= file.size;
+        release_condition.notify_one();
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0, n = std::min(thread_count(), files.size()); i < n; ++i) {
+        workers.emplace_back([&] {
+            while (true) {
+                size_t file_index, chunk_count;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    parse_condition.wait(lock, [&] { return !read_files.empty() || done_reading; });
+                    if (read_files.empty())
+                        return;
+                    file_index = read_files.back();
+                    read_files.pop_back();
+                    // The threads are shared by the files that are parsed at the same time, so that a
+                    // large file gets all of them when it is parsed alone
+                    chunk_count = std::max(thread_count() / ++parse_count, size_t(1));
+                }
+                auto& file = opened_files[file_index];
+                meshes[file_index] = load_from_memory(file.data.get(), file.data.get() + file.size, nullptr, chunk_count);
+                loaded[file_index] = true;
+                release_file(file);
+                std::lock_guard<std::mutex> lock(mutex);
+                parse_count--;
+            }
+        });
+    }
+
+    // Files are opened when they are reached, so that only the files being read are open
+    auto open_file = [&] (size_t file_index) {
+        auto& file = opened_files[file_index];
+        file.fd = open(files[file_index].c_str(), O_RDONLY | O_CLOEXEC);
+        if (file.fd < 0)
+            return false;
+        struct stat info;
+        bool has_size = fstat(file.fd, &info) == 0;
+        if (!has_size || info.st_size <= 0 || !S_ISREG(info.st_mode)) {
+            // Empty files produce empty meshes
+            loaded[file_index] = has_size && info.st_size == 0 && S_ISREG(info.st_mode);
+            close(file.fd);
+            file.fd = -1;
+            return false;
+        }
+        file.size = file.remaining = static_cast<size_t>(info.st_size);
+        return true;
+    };
+    auto fits_in_budget = [&] (size_t size) {
+        return buffered_size == 0 || buffered_size + size <= max_buffered_size;
+    };
+    // Returns false when all the files have been read, or when the next file does not fit in the budget
+    size_t next_file = 0, next_offset = 0;
+    auto next_read = [&] (Read& read) {
+        while (next_file < files.size()) {
+            auto& file = opened_files[next_file];
+            if (next_offset == 0 && !file.data) {
+                if (file.fd < 0 && !open_file(next_file)) {
+                    next_file++;
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!fits_in_budget(file.size))
+                        return false;
+                    buffered_size += file.size;
+                }
+                file.data.reset(new char[file.size]);
+            }
+            if (!file.failed && next_offset < file.size) {
+                read = Read { next_file, next_offset, std::min(block_size, file.size - next_offset) };
+                next_offset += read.size;
+                return true;
+            }
+            next_file++;
+            next_offset = 0;
+        }
+        return false;
+    };
+
+    std::vector<Read> reads(ring.capacity());
+    std::vector<size_t> free_slots(ring.capacity());
+    std::iota(free_slots.begin(), free_slots.end(), 0);
+    std::vector<Read> short_reads;
+    while (true) {
+        // Short reads are completed before new blocks are read, to finish the files early
+        while (!free_slots.empty()) {
+            Read read;
+            if (!short_reads.empty()) {
+                read = short_reads.back();
+                short_reads.pop_back();
+            } else if (!next_read(read))
+                break;
+            auto slot = free_slots.back();
+            free_slots.pop_back();
+            auto& file = opened_files[read.file_index];
+            reads[slot] = read;
+            file.pending_reads++;
+            ring.read(file.fd, file.data.get() + read.offset, read.size, read.offset, slot);
+        }
+        if (free_slots.size() == ring.capacity()) {
+            if (next_file == files.size())
+                break;
+            // Nothing is in flight, and the next file does not fit in the budget yet
+            std::unique_lock<std::mutex> lock(mutex);
+            release_condition.wait(lock, [&] { return fits_in_budget(opened_files[next_file].size); });
+            continue;
+        }
+
+        if (!ring.submit_and_wait(1)) {
+            // The buffers of the reads in flight must stay alive, since the kernel may still write to them
+            for (auto& file : opened_files) {
+                if (file.pending_reads > 0)
+                    file.data.release();
+            }
+            break;
+        }
+
+        ring.for_each_completion([&] (uint64_t slot, int result) {
+            auto read = reads[slot];
+            auto& file = opened_files[read.file_index];
+            free_slots.push_back(slot);
+            file.pending_reads--;
+            if (result == -EINTR || result == -EAGAIN)
+                short_reads.push_back(read);
+            else if (result <= 0)
+                file.failed = true;
+            else {
+                auto size = static_cast<size_t>(result);
+                if (size < read.size)
+                    short_reads.push_back(Read { read.file_index, read.offset + size, read.size - size });
+                file.remaining -= size;
+            }
+
+            if (file.failed && file.pending_reads == 0) {
+                close(file.fd);
+                release_file(file);
+            } else if (!file.failed && file.remaining == 0) {
+                close(file.fd);
+                std::lock_guard<std::mutex> lock(mutex);
+                read_files.push_back(read.file_index);
+                parse_condition.notify_one();
+            }
+        });
+        // The reads that remain for a file that failed are not needed anymore
+        short_reads.erase(std::remove_if(short_reads.begin(), short_reads.end(),
+            [&] (const Read& read) { return opened_files[read.file_index].failed; }), short_reads.end());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done_reading = true;
+    }
+    parse_condition.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+#endif
+
+// Loads several files into a single mesh. With io_uring, the files are read and parsed while the next
+// files are being read. Otherwise, or when this fails, `load_from_file()` is used instead.
+// Returns nothing if a file cannot be read, and sets `failed_file` to its name.
+inline std::optional<Mesh> load_from_files(
+    const std::vector<std::string>& files,
+    BuildInput* input,
+    std::string& failed_file)
+{
+    std::vector<Mesh> meshes(files.size());
+    std::vector<char> loaded(files.size(), false);
+#if defined(BVH_HAS_IO_URING)
+    load_with_io_ring(files, meshes, loaded);
+#endif
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (loaded[i])
+            continue;
+        if (!is_readable_file(files[i])) {
+            failed_file = files[i];
+            return std::nullopt;
+        }
+        meshes[i] = load_from_file(files[i]);
+    }
+    auto mesh = merge_meshes(meshes);
+    if (input)
+        compute_build_input(mesh, *input);
+    return std::make_optional(std::move(mesh));
+}
+
+// Binary cache of a mesh loaded from an OBJ file. The header is followed by the vertices and then by
+// the indices, in the native byte order. The size and modification time of the source file are
+// recorded in the header, and a cache that does not match them is ignored.
+struct CacheHeader {
+    static constexpr char expected_magic[8] = { 'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E' };
+    static constexpr uint32_t current_version = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t vertex_size;
+    uint64_t source_size;
+    int64_t source_time;
+    uint64_t vertex_count;
+    uint64_t index_count;
+
+    static std::optional<CacheHeader> from_source(const std::string& source_file) {
+        std::error_code error;
+        auto size = std::filesystem::file_size(source_file, error);
+        if (error)
+            return std::nullopt;
+        auto time = std::filesystem::last_write_time(source_file, error);
+        if (error)
+            return std::nullopt;
+        CacheHeader header;
+        std::memcpy(header.magic, expected_magic, sizeof(magic));
+        header.version = current_version;
+        header.vertex_size = sizeof(Vec3);
+        header.source_size = size;
+        header.source_time = time.time_since_epoch().count();
+        header.vertex_count = 0;
+        header.index_count = 0;
+        return std::make_optional(header);
+    }
+
+    bool matches(const CacheHeader& other) const {
+        return
+            std::memcmp(magic, other.magic, sizeof(magic)) == 0 &&
+            version == other.version &&
+            vertex_size == other.vertex_size &&
+            source_size == other.source_size &&
+            source_time == other.source_time;
+    }
+
+    // Checks that the file has exactly the size given by the counts, without overflowing
+    bool matches_file_size(size_t file_size) const {
+        if (file_size < sizeof(CacheHeader) || vertex_count > (file_size - sizeof(CacheHeader)) / sizeof(Vec3))
+            return false;
+        auto remaining = file_size - sizeof(CacheHeader) - vertex_count * sizeof(Vec3);
+        return remaining % sizeof(uint32_t) == 0 && index_count == remaining / sizeof(uint32_t);
+    }
+};
+
+// Returns nothing if the cache does not exist, or if it is out of date
+inline std::optional<Mesh> load_from_cache(const std::string& cache_file, const std::string& source_file) {
+    auto expected_header = CacheHeader::from_source(source_file);
+    auto mapped_file = MappedFile::map(cache_file);
+    if (!expected_header || !mapped_file || mapped_file.size() < sizeof(CacheHeader))
+        return std::nullopt;
+
+    CacheHeader header;
+    std::memcpy(&header, mapped_file.data(), sizeof(CacheHeader));
+    if (!header.matches(*expected_header) || !header.matches_file_size(mapped_file.size()) || header.index_count % 3 != 0)
+        return std::nullopt;
+
+    Mesh mesh;
+    mesh.vertices.resize(header.vertex_count);
+    mesh.indices.resize(header.index_count);
+    auto vertices = mapped_file.data() + sizeof(CacheHeader);
+    auto indices = vertices + header.vertex_count * sizeof(Vec3);
+    std::memcpy(mesh.vertices.data(), vertices, header.vertex_count * sizeof(Vec3));
+    std::memcpy(mesh.indices.data(), indices, header.index_count * sizeof(uint32_t));
+
+    // The indices are used without bounds checks, so they cannot be trusted blindly
+    if (std::any_of(mesh.indices.begin(), mesh.indices.end(), [&] (uint32_t index) { return index >= header.vertex_count; }))
+        return std::nullopt;
+    return std::make_optional(std::move(mesh));
+}
+
+// Writes the cache to a temporary file of its own first, so that other processes, including those
+// that write the same cache at the same time, never see a partial cache
+inline bool save_to_cache(const Mesh& mesh, const std::string& cache_file, const std::string& source_file) {
+    auto header = CacheHeader::from_source(source_file);
+    if (!header)
+        return false;
+    header->vertex_count = mesh.vertices.size();
+    header->index_count = mesh.indices.size();
+
+    auto temp_file = create_temp_file(cache_file);
+    if (!temp_file)
+        return false;
+    std::error_code error;
+    {
+        std::ofstream os(*temp_file, std::ofstream::binary);
+        os.write(reinterpret_cast<const char*>(&*header), sizeof(CacheHeader));
+        os.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vec3));
+        os.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(uint32_t));
+        if (!os) {
+            os.close();
+            std::filesystem::remove(*temp_file, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(*temp_file, cache_file, error);
+    if (!error)
+        return true;
+    std::filesystem::remove(*temp_file, error);
+    return false;
+}
+
+// Loads the mesh from the cache when it is up to date, otherwise parses the OBJ file and writes the
+// cache for the next time
+inline Mesh load_cached(const std::string& file, const std::string& cache_file, BuildInput* input = nullptr) {
+    if (auto mesh = load_from_cache(cache_file, file)) {
+        if (input)
+            compute_build_input(*mesh, *input);
+        return std::move(*mesh);
+    }
+    auto mesh = load_from_file(file, input);
+    if (mesh.triangle_count() > 0 && !save_to_cache(mesh, cache_file, file))
+        std::cerr << "Cannot write mesh cache '" << cache_file << "'" << std::endl;
+    return mesh;
+}
+
+} // namespace obj
+
+namespace ply {
+
+// Loader for binary little-endian PLY files. Only the positions of the vertices and the vertex
+// indices of the faces are used, all other properties and elements are skipped.
+
+enum class Type { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+inline std::optional<Type> parse_type(const std::string& name) {
+    if (name == "char"   || name == "int8")    return Type::Int8;
+    if (name == "uchar"  || name == "uint8")   return Type::UInt8;
+    if (name == "short"  || name == "int16")   return Type::Int16;
+    if (name == "ushort" || name == "uint16")  return Type::UInt16;
+    if (name == "int"    || name == "int32")   return Type::Int32;
+    if (name == "uint"   || name == "uint32")  return Type::UInt32;
+    if (name == "float"  || name == "float32") return Type::Float32;
+    if (name == "double" || name == "float64") return Type::Float64;
+    return std::nullopt;
+}
+
+inline size_t type_size(Type type) {
+    switch (type) {
+        case Type::Int8:  case Type::UInt8:  return 1;
+        case Type::Int16: case Type::UInt16: return 2;
+        case Type::Int32: case Type::UInt32: case Type::Float32: return 4;
+        default: return 8;
+    }
+}
+
+template <typename T>
+T load(const char* ptr) {
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+// Reads a value of the given type and converts it. The host must be little-endian.
+template <typename T>
+T read_value(const char* ptr, Type type) {
+    switch (type) {
+        case Type::Int8:    return static_cast<T>(load<int8_t>(ptr));
+        case Type::UInt8:   return static_cast<T>(load<uint8_t>(ptr));
+        case Type::Int16:   return static_cast<T>(load<int16_t>(ptr));
+        case Type::UInt16:  return static_cast<T>(load<uint16_t>(ptr));
+        case Type::Int32:   return static_cast<T>(load<int32_t>(ptr));
+        case Type::UInt32:  return static_cast<T>(load<uint32_t>(ptr));
+        case Type::Float32: return static_cast<T>(load<float>(ptr));
+        default:            return static_cast<T>(load<double>(ptr));
+    }
+}
+
+struct Property {
+    std::string name;
+    Type type;                      // Type of the items, for lists
+    std::optional<Type> count_type; // Only set for lists
+};
+
+struct Element {
+    std::string name;
+    size_t count;
+    std::vector<Property> properties;
+
+    std::optional<size_t> find(const std::string& name) const {
+        for (size_t i = 0; i < properties.size(); ++i) {
+            if (properties[i].name == name)
+                return std::make_optional(i);
+        }
+        return std::nullopt;
+    }
+
+    // Returns the size of every element, or nothing if the elements contain lists
+    std::optional<size_t> fixed_size() const {
+        size_t size = 0;
+        for (auto& property : properties) {
+            if (property.count_type)
+                return std::nullopt;
+            size += type_size(property.type);
+        }
+        return std::make_optional(size);
+    }
+
+    // Calls `f(i, ptr, count)` for every property of the element starting at `ptr`, with the
+    // number of items for lists, and 1 for other properties. Returns the end of the element.
+    template <typename F>
+    const char* visit(const char* ptr, const char* end, F&& f) const {
+        for (size_t i = 0; i < properties.size(); ++i) {
+            auto& property = properties[i];
+            size_t count = 1;
+            if (property.count_type) {
+                auto count_size = type_size(*property.count_type);
+                if (static_cast<size_t>(end - ptr) < count_size)
+                    return nullptr;
+                count = read_value<size_t>(ptr, *property.count_type);
+                ptr += count_size;
+            }
+            auto size = count * type_size(property.type);
+            if (static_cast<size_t>(end - ptr) < size)
+                return nullptr;
+            f(i, ptr, count);
+            ptr += size;
+        }
+        return ptr;
+    }
+};
+
+// Parses the header, and returns the elements it declares, along with the start of the data
+inline std::optional<std::pair<std::vector<Element>, const char*>> parse_header(const char* begin, const char* end) {
+    static constexpr char end_marker[] = "end_header";
+    std::vector<Element> elements;
+    bool is_binary_little_endian = false;
+    for (const char* line = begin; line != end;) {
+        auto line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        if (!line_end)
+            return std::nullopt;
+
+        std::istringstream is(std::string(line, line_end));
+        std::string keyword;
+        is >> keyword;
+        if (line == begin && keyword != "ply")
+            return std::nullopt;
+        if (keyword == "format") {
+            std::string format, version;
+            is >> format >> version;
+            is_binary_little_endian = format == "binary_little_endian" && version == "1.0";
+        } else if (keyword == "element") {
+            Element element;
+            is >> element.name >> element.count;
+            if (!is)
+                return std::nullopt;
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            std::string type_name;
+            Property property;
+            is >> type_name;
+            if (type_name == "list") {
+                std::string count_type_name;
+                is >> count_type_name >> type_name;
+                property.count_type = parse_type(count_type_name);
+                if (!property.count_type)
+                    return std::nullopt;
+            }
+            auto type = parse_type(type_name);
+            is >> property.name;
+            if (!type || !is || elements.empty())
+                return std::nullopt;
+            property.type = *type;
+            elements.back().properties.push_back(property);
+        } else if (keyword == end_marker) {
+            if (!is_binary_little_endian)
+                return std::nullopt;
+            return std::make_optional(std::make_pair(std::move(elements), line_end + 1));
+        }
+        line = line_end + 1;
+    }
+    return std::nullopt;
+}
+
+// Returns an empty mesh if the file is not a valid binary little-endian PLY file. When given, the
+// inputs of the builders are computed from the mesh.
+inline Mesh load_from_memory(const char* begin, const char* end, BuildInput* input = nullptr) {
+    static const bool is_little_endian_host = [] {
+        uint16_t value = 1;
+        return load<uint8_t>(reinterpret_cast<const char*>(&value)) == 1;
+    } ();
+    auto header = parse_header(begin, end);
+    if (!header || !is_little_endian_host)
+        return Mesh();
+
+    Mesh mesh;
+    auto ptr = header->second;
+    for (auto& element : header->first) {
+        auto fixed_size = element.fixed_size();
+        if (element.name == "vertex") {
+            auto x = element.find("x"), y = element.find("y"), z = element.find("z");
+            if (!x || !y || !z || !fixed_size || static_cast<size_t>(end - ptr) / *fixed_size < element.count)
+                return Mesh();
+            mesh.vertices.resize(element.count);
+            auto& properties = element.properties;
+            if (*x == 0 && *y == 1 && *z == 2 && *fixed_size == sizeof(Vec3) &&
+                properties[0].type == Type::Float32 &&
+                properties[1].type == Type::Float32 &&
+                properties[2].type == Type::Float32)
+            {
+                // The vertices only contain the positions, stored as floats: They can be copied at once
+                std::memcpy(mesh.vertices.data(), ptr, element.count * sizeof(Vec3));
+            } else {
+                size_t offsets[3] = {};
+                for (size_t i = 0; i < properties.size(); ++i) {
+                    for (int axis = 0; axis < 3; ++axis) {
+                        if (i < (axis == 0 ? *x : axis == 1 ? *y : *z))
+                            offsets[axis] += type_size(properties[i].type);
+                    }
+                }
+                for (size_t i = 0; i < element.count; ++i) {
+                    auto vertex = ptr + i * *fixed_size;
+                    mesh.vertices[i] = Vec3(
+                        read_value<float>(vertex + offsets[0], properties[*x].type),
+                        read_value<float>(vertex + offsets[1], properties[*y].type),
+                        read_value<float>(vertex + offsets[2], properties[*z].type));
+                }
+            }
+            ptr += element.count * *fixed_size;
+        } else if (element.name == "face") {
+            auto indices = element.find("vertex_indices");
+            if (!indices)
+                indices = element.find("vertex_index");
+            if (!indices || !element.properties[*indices].count_type)
+                return Mesh();
+            auto index_type = element.properties[*indices].type;
+            auto index_size = type_size(index_type);
+            auto count_type = *element.properties[*indices].count_type;
+            auto count_size = type_size(count_type);
+
+            // Faces made only of triangles with 32-bit indices, which is the common case, are copied
+            // in a single strided pass. The other faces are triangulated one after the other.
+            auto first_index = mesh.indices.size();
+            auto stride = count_size + 3 * sizeof(uint32_t);
+            bool is_triangle_list =
+                element.properties.size() == 1 && index_size == sizeof(uint32_t) &&
+                static_cast<size_t>(end - ptr) / stride >= element.count;
+            if (is_triangle_list) {
+                mesh.indices.resize(first_index + 3 * element.count);
+                auto triangle_indices = mesh.indices.data() + first_index;
+                for (size_t i = 0; i < element.count && is_triangle_list; ++i, triangle_indices += 3) {
+                    auto face = ptr + i * stride;
+                    std::memcpy(triangle_indices, face + count_size, 3 * sizeof(uint32_t));
+                    // Negative signed indices become large unsigned ones, and are rejected as well
+                    auto max_index = std::max(triangle_indices[0], std::max(triangle_indices[1], triangle_indices[2]));
+                    is_triangle_list = read_value<size_t>(face, count_type) == 3 && max_index < mesh.vertices.size();
+                }
+                if (is_triangle_list) {
+                    ptr += element.count * stride;
+                    continue;
+                }
+                mesh.indices.resize(first_index);
+            }
+
+            mesh.indices.reserve(first_index + 3 * element.count);
+            bool is_valid = true;
+            for (size_t i = 0; i < element.count && ptr; ++i) {
+                ptr = element.visit(ptr, end, [&] (size_t property, const char* items, size_t count) {
+                    if (property != *indices)
+                        return;
+                    // Polygons are triangulated as a fan, as in OBJ files
+                    uint32_t first = 0, last = 0;
+                    for (size_t j = 0; j < count; ++j) {
+                        auto value = read_value<int64_t>(items + j * index_size, index_type);
+                        if (value < 0 || static_cast<size_t>(value) >= mesh.vertices.size()) {
+                            is_valid = false;
+                            return;
+                        }
+                        auto index = static_cast<uint32_t>(value);
+                        if (j >= 2) {
+                            mesh.indices.push_back(first);
+                            mesh.indices.push_back(last);
+                            mesh.indices.push_back(index);
+                        } else if (j == 0)
+                            first = index;
+                        last = index;
+                    }
+                });
+            }
+            if (!ptr || !is_valid)
+                return Mesh();
+        } else if (fixed_size) {
+            // Elements without properties take no space
+            if (*fixed_size != 0 && static_cast<size_t>(end - ptr) / *fixed_size < element.count)
+                return Mesh();
+            ptr += element.count * *fixed_size;
+        } else {
+            for (size_t i = 0; i < element.count && ptr; ++i)
+                ptr = element.visit(ptr, end, [] (size_t, const char*, size_t) {});
+            if (!ptr)
+                return Mesh();
+        }
+    }
+
+    if (input)
+        compute_build_input(mesh, *input);
+    return mesh;
+}
+
+inline Mesh load_from_file(const std::string& file, BuildInput* input = nullptr) {
+    if (auto mapped_file = MappedFile::map(file))
+        return load_from_memory(mapped_file.data(), mapped_file.data() + mapped_file.size(), input);
+    std::ifstream is(file, std::ifstream::binary);
+    if (!is)
+        return Mesh();
+    std::string contents(std::istreambuf_iterator<char>(is), {});
+    return load_from_memory(contents.data(), contents.data() + contents.size(), input);
+}
+
+} // namespace ply
+
+// BVH file, which can be mapped in memory and traversed in place. The header is followed by the
+// nodes and then by the primitive indices, each starting at an offset that is a multiple of
+// `alignment` from the beginning of the file. Only offsets are stored, so the file can be mapped at
+// any address. Multi-byte values are stored in the native byte order, which the magic number
+// checks. The checksum covers the nodes and primitive indices, and the mesh checksum identifies the
+// mesh that the BVH has been built for.
+struct BvhFileHeader {
+    static constexpr char expected_magic[8] = { 'B', 'V', 'H', 'F', 'I', 'L', 'E', '\0' };
+    static constexpr uint32_t current_version = 2;
+    static constexpr uint32_t byte_order_mark = 0x01020304;
+    static constexpr size_t alignment = 64;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t index_size;
+    uint32_t node_size;
+    uint32_t layout;
+    BuilderRecord builder;
+    uint64_t node_count;
+    uint64_t prim_count;
+    uint64_t nodes_offset;
+    uint64_t prim_indices_offset;
+    uint64_t file_size;
+    uint64_t checksum;
+    uint64_t mesh_checksum;
+};
+
+inline size_t align_up(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Word-wise variant of the FNV-1a hash
+inline uint64_t checksum(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325) {
+    static constexpr uint64_t prime = 0x100000001b3;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(uint64_t));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+    return hash;
+}
+
+inline uint64_t checksum(const Mesh& mesh) {
+    return checksum(
+        reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(uint32_t),
+        checksum(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vec3)));
+}
+
+template <typename Index>
+bool save_bvh(const BasicBvh<Index>& bvh, const BuilderRecord& builder, const Mesh& mesh, const std::string& file) {
+    using Node = BasicNode<Index>;
+    static constexpr size_t alignment = BvhFileHeader::alignment;
+
+    // The header has padding, which is written as zeros
+    BvhFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, BvhFileHeader::expected_magic, sizeof(header.magic));
+    header.version = BvhFileHeader::current_version;
+    header.byte_order = BvhFileHeader::byte_order_mark;
+    header.index_size = sizeof(Index);
+    header.node_size = sizeof(Node);
+    header.layout = static_cast<uint32_t>(bvh.layout);
+    header.builder = builder;
+    header.node_count = bvh.nodes.size();
+    header.prim_count = bvh.prim_indices.size();
+    header.nodes_offset = align_up(sizeof(BvhFileHeader), alignment);
+    header.prim_indices_offset = align_up(header.nodes_offset + header.node_count * sizeof(Node), alignment);
+    header.file_size = header.prim_indices_offset + header.prim_count * sizeof(Index);
+    header.checksum = checksum(
+        reinterpret_cast<const char*>(bvh.prim_indices.data()), header.prim_count * sizeof(Index),
+        checksum(reinterpret_cast<const char*>(bvh.nodes.data()), header.node_count * sizeof(Node)));
+    header.mesh_checksum = checksum(mesh);
+
+    std::ofstream os(file, std::ofstream::binary);
+    static const char padding[alignment] = {};
+    os.write(reinterpret_cast<const char*>(&header), sizeof(BvhFileHeader));
+    os.write(padding, header.nodes_offset - sizeof(BvhFileHeader));
+    os.write(reinterpret_cast<const char*>(bvh.nodes.data()), header.node_count * sizeof(Node));
+    os.write(padding, header.prim_indices_offset - header.nodes_offset - header.node_count * sizeof(Node));
+    os.write(reinterpret_cast<const char*>(bvh.prim_indices.data()), header.prim_count * sizeof(Index));
+    return static_cast<bool>(os);
+}
+
+// BVH that is traversed directly from a mapped BVH file, without copying it
+template <typename Index>
+struct BasicMappedBvh {
+    using Hit = BasicHit<Index>;
+    using Node = BasicNode<Index>;
+    using Layout = BvhLayout;
+
+    MappedFile file;
+    BvhFileHeader header;
+    const Node* nodes = nullptr;
+    const Index* prim_indices = nullptr;
+
+    // Returns nothing if the file cannot be mapped, if it has been written by an incompatible
+    // version of this program, or if it is corrupted
+    static std::optional<BasicMappedBvh> map(const std::string& file_name, bool verify_checksum = true) {
+        BasicMappedBvh bvh;
+        bvh.file = MappedFile::map(file_name);
+        if (!bvh.file || bvh.file.size() < sizeof(BvhFileHeader))
+            return std::nullopt;
+        auto& header = bvh.header;
+        std::memcpy(&header, bvh.file.data(), sizeof(BvhFileHeader));
+        // Checks that an array is contained in the given range, without overflowing
+        auto fits = [] (uint64_t offset, uint64_t count, size_t elem_size, uint64_t end) {
+            return offset <= end && count <= (end - offset) / elem_size;
+        };
+        if (std::memcmp(header.magic, BvhFileHeader::expected_magic, sizeof(header.magic)) != 0 ||
+            header.version != BvhFileHeader::current_version ||
+            header.byte_order != BvhFileHeader::byte_order_mark ||
+            header.index_size != sizeof(Index) ||
+            header.node_size != sizeof(Node) ||
+            header.layout > static_cast<uint32_t>(Layout::VanEmdeBoas) ||
+            header.node_count == 0 ||
+            header.file_size != bvh.file.size() ||
+            header.nodes_offset % BvhFileHeader::alignment != 0 ||
+            header.prim_indices_offset % BvhFileHeader::alignment != 0 ||
+            header.nodes_offset < sizeof(BvhFileHeader) ||
+            !fits(header.nodes_offset, header.node_count, sizeof(Node), header.prim_indices_offset) ||
+            !fits(header.prim_indices_offset, header.prim_count, sizeof(Index), header.file_size))
+            return std::nullopt;
+
+        // Mappings are aligned to a page boundary, so the offsets are enough to align the arrays
+        auto nodes_data = bvh.file.data() + header.nodes_offset;
+        auto prim_indices_data = bvh.file.data() + header.prim_indices_offset;
+        if (verify_checksum &&
+            checksum(prim_indices_data, header.prim_count * sizeof(Index),
+                checksum(nodes_data, header.node_count * sizeof(Node))) != header.checksum)
+            return std::nullopt;
+        bvh.nodes = reinterpret_cast<const Node*>(nodes_data);
+        bvh.prim_indices = reinterpret_cast<const Index*>(prim_indices_data);
+        return std::make_optional(std::move(bvh));
+    }
+
+    Layout layout() const { return static_cast<Layout>(header.layout); }
+    size_t node_count() const { return header.node_count; }
+    size_t prim_count() const { return header.prim_count; }
+
+    size_t left_child(size_t node_index) const {
+        return layout() == Layout::DepthFirst ? node_index + 1 : nodes[node_index].first_index;
+    }
+
+    size_t right_child(size_t node_index) const {
+        return layout() == Layout::DepthFirst ? nodes[node_index].first_index : nodes[node_index].first_index + 1;
+    }
+
+    template <typename Prims>
+    Hit traverse(Ray& ray, const Prims& prims) const;
+};
+
+template <typename Index>
+template <typename Prims>
+BasicHit<Index> BasicMappedBvh<Index>::traverse(Ray& ray, const Prims& prims) const {
+    auto hit = Hit::none();
+    std::stack<Index> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        auto node_index = stack.top();
+        auto& node = nodes[node_index];
+        stack.pop();
+        if (!node.intersect(ray))
+            continue;
+
+        if (node.is_leaf()) {
+            for (size_t i = 0; i < node.prim_count; ++i) {
+                auto prim_index = prim_indices[node.first_index + i];
+                hit.intersect(prim_index, prims[prim_index], ray);
+            }
+        } else {
+            stack.push(left_child(node_index));
+            stack.push(right_child(node_index));
+        }
+    }
+    return hit;
+}
+
+using MappedBvh = BasicMappedBvh<uint32_t>;
+
+static const size_t width = 1024;
+static const size_t height = 1024;
+static const size_t tile_width = 4;
+static const size_t tile_height = 4;
+static const size_t bundle_width = 16;
+static const size_t bundle_height = 16;
+static const auto output_file = "out.ppm";
+
+template <typename F>
+static long long measure_ms(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Loads the scene, builds the BVH with the builder of the example, and renders the scene with the
+// traversal selected by the options. The builder is the one of `BasicBvh::build()`, which each example
+// defines: `builder` is recorded in the BVH files it saves, and `builder_needs_mortons` tells if the
+// loader must compute Morton codes for it.
+inline int run_example(int argc, char** argv, const BuilderRecord& builder, bool builder_needs_mortons) {
+    Vec3 eye(0, 1, 3);
+    Vec3 dir(0, 0, -1);
+    Vec3 up(0, 1, 0);
+
+    if (argc < 2) {
+        std::cerr << "Missing input file" << std::endl;
+        return 1;
+    }
+    // Several OBJ files can be given, in which case they are merged into a single mesh
+    std::vector<std::string> input_files { argv[1] };
+    bool use_quantized_bvh = false;
+    bool use_paired_bvh = false;
+    bool use_packets = true;
+    bool use_frustum = false;
+    bool use_stackless = false;
+    bool use_precomputed = false;
+    bool use_blocks = false;
+    bool use_permuted = false;
+    bool use_index64 = false;
+    size_t prefetch_distance = 0;
+    bool use_indexed = false;
+    bool use_cache = false;
+    std::optional<float> weld_tolerance;
+    std::string load_bvh_file;
+    std::string save_bvh_file;
+    bool bench_secondary = false;
+    auto layout = Bvh::Layout::SiblingPairs;
+    for (int i = 2; i < argc; ++i) {
+        std::string option(argv[i]);
+        if (option == "--quantized")
+            use_quantized_bvh = true;
+        else if (option == "--paired")
+            use_paired_bvh = true;
+        else if (option == "--single")
+            use_packets = false;
+        else if (option == "--frustum")
+            use_frustum = true;
+        else if (option == "--secondary")
+            bench_secondary = true;
+        else if (option == "--layout=depth-first")
+            layout = Bvh::Layout::DepthFirst;
+        else if (option == "--layout=van-emde-boas")
+            layout = Bvh::Layout::VanEmdeBoas;
+        else if (option == "--stackless")
+            use_stackless = true;
+        else if (option == "--precomputed")
+            use_precomputed = true;
+        else if (option == "--blocks")
+            use_blocks = true;
+        else if (option == "--permuted")
+            use_permuted = true;
+        else if (option == "--index64")
+            use_index64 = true;
+        else if (option == "--indexed")
+            use_indexed = true;
+        else if (option == "--cache")
+            use_cache = true;
+        else if (option == "--weld")
+            weld_tolerance = 0.0f;
+        else if (option.rfind("--weld=", 0) == 0) {
+            char* tolerance_end = nullptr;
+            weld_tolerance = std::strtof(option.c_str() + 7, &tolerance_end);
+            if (option.size() == 7 || *tolerance_end != '\0' || !std::isfinite(*weld_tolerance) || *weld_tolerance < 0) {
+                std::cerr << "Invalid weld tolerance '" << option.c_str() + 7 << "'" << std::endl;
+                return 1;
+            }
+        }
+        else if (option.rfind("--load-bvh=", 0) == 0)
+            load_bvh_file = option.substr(11);
+        else if (option.rfind("--save-bvh=", 0) == 0)
+            save_bvh_file = option.substr(11);
+        else if (option[0] != '-' && option.size() > 4 && option.compare(option.size() - 4, 4, ".obj") == 0)
+            input_files.push_back(option);
+        else if (option.rfind("--prefetch=", 0) == 0) {
+            prefetch_distance = std::strtoul(option.c_str() + 11, nullptr, 10);
+            if (prefetch_distance != 1 && prefetch_distance != 2 && prefetch_distance != 4 && prefetch_distance != 8) {
+                std::cerr << "Invalid prefetch distance '" << option.c_str() + 11 << "'" << std::endl;
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option '" << argv[i] << "'" << std::endl;
+            return 1;
+        }
+    }
+    // Each of these options selects a different traversal, and the traversals cannot be combined
+    int traversal_count =
+        use_quantized_bvh + use_paired_bvh + use_frustum + use_stackless + use_precomputed +
+        use_blocks + use_permuted;
+    if (traversal_count > 1) {
+        std::cerr
+            << "Options '--quantized', '--paired', '--frustum', '--stackless', '--precomputed', "
+            << "'--blocks' and '--permuted' cannot be combined" << std::endl;
+        return 1;
+    }
+    if (use_frustum && !use_packets) {
+        std::cerr << "Option '--single' does not work with '--frustum'" << std::endl;
+        return 1;
+    }
+    // The quantized and paired BVHs have their own layout, leaves are collapsed into blocks in the
+    // default layout, and the stackless traversal needs the depth-first layout
+    if ((layout != Bvh::Layout::SiblingPairs && (use_quantized_bvh || use_paired_bvh || use_blocks)) ||
+        (layout != Bvh::Layout::DepthFirst && layout != Bvh::Layout::SiblingPairs && use_stackless))
+    {
+        std::cerr << "Option '--layout' does not work with the selected traversal" << std::endl;
+        return 1;
+    }
+    if (use_indexed && (
+        use_quantized_bvh || use_paired_bvh || use_frustum || use_stackless || use_precomputed ||
+        use_blocks || use_permuted || use_index64 || prefetch_distance != 0 || bench_secondary))
+    {
+        std::cerr << "Option '--indexed' only works with the packet and single-ray traversals" << std::endl;
+        return 1;
+    }
+    if (use_index64 && (
+        use_quantized_bvh || use_paired_bvh || use_frustum || use_stackless || use_precomputed ||
+        use_blocks || use_permuted || prefetch_distance != 0 || bench_secondary || !save_bvh_file.empty()))
+    {
+        std::cerr << "Option '--index64' only works with the packet and single-ray traversals" << std::endl;
+        return 1;
+    }
+    if (prefetch_distance != 0 && (
+        use_quantized_bvh || use_paired_bvh || use_frustum || use_stackless || use_precomputed ||
+        use_blocks || use_permuted))
+    {
+        std::cerr << "Option '--prefetch' only works with the single-ray traversal" << std::endl;
+        return 1;
+    }
+    // A saved BVH keeps the layout it was saved with
+    if (!load_bvh_file.empty() && (
+        use_quantized_bvh || use_paired_bvh || use_frustum || use_stackless || use_precomputed ||
+        use_blocks || use_permuted || use_index64 || prefetch_distance != 0 || bench_secondary ||
+        !save_bvh_file.empty() || layout != Bvh::Layout::SiblingPairs))
+    {
+        std::cerr << "Option '--load-bvh' only works with the single-ray traversal" << std::endl;
+        return 1;
+    }
+
+    // The loader computes the inputs of the builder, unless the BVH is loaded from a file, or unless
+    // the mesh is modified after loading
+    Mesh mesh;
+    BuildInput input;
+    input.with_mortons = builder_needs_mortons;
+    auto input_ptr = load_bvh_file.empty() && !weld_tolerance ? &input : nullptr;
+    auto is_ply_file = [] (const std::string& file) {
+        return file.size() >= 4 && file.compare(file.size() - 4, 4, ".ply") == 0;
+    };
+    auto& input_file = input_files[0];
+    bool is_ply = is_ply_file(input_file);
+    if (is_ply && use_cache) {
+        std::cerr << "Option '--cache' only works with OBJ files" << std::endl;
+        return 1;
+    }
+    if (input_files.size() > 1 && (use_cache || std::any_of(input_files.begin(), input_files.end(), is_ply_file))) {
+        std::cerr << "Only OBJ files without '--cache' can be loaded together" << std::endl;
+        return 1;
+    }
+    std::string failed_file;
+    auto load_time = measure_ms([&] {
+        if (input_files.size() > 1) {
+            if (auto merged_mesh = obj::load_from_files(input_files, input_ptr, failed_file))
+                mesh = std::move(*merged_mesh);
+        } else if (!is_readable_file(input_file))
+            failed_file = input_file;
+        else if (is_ply)
+            mesh = ply::load_from_file(input_file, input_ptr);
+        else if (use_cache)
+            mesh = obj::load_cached(input_file, input_file + ".cache", input_ptr);
+        else
+            mesh = obj::load_from_file(input_file, input_ptr);
+    });
+    if (!failed_file.empty()) {
+        std::cerr << "Cannot read input file '" << failed_file << "'" << std::endl;
+        return 1;
+    }
+    if (mesh.triangle_count() == 0) {
+        std::cerr << "No triangle was found in input file" << std::endl;
+        return 1;
+    }
+    std::cout
+        << "Loaded file with " << mesh.triangle_count() << " triangle(s) and "
+        << mesh.vertices.size() << " vertices in " << load_time << "ms" << std::endl;
+
+    if (weld_tolerance) {
+        WeldResult weld_result;
+        auto weld_time = measure_ms([&] {
+            weld_result = weld_vertices(mesh, *weld_tolerance);
+            if (load_bvh_file.empty())
+                compute_build_input(mesh, input);
+        });
+        std::cout
+            << "Welded " << weld_result.removed_vertices << " vertices and removed "
+            << weld_result.removed_triangles << " degenerate triangle(s) in " << weld_time << "ms" << std::endl;
+    }
+
+    // The indexed mode traverses the mesh directly, the others use a copy of every triangle. The
+    // mesh is then only kept if BVH files need it, to reduce the peak memory usage.
+    std::vector<Triangle> tris;
+    if (!use_indexed) {
+        tris = mesh.triangles();
+        if (load_bvh_file.empty() && save_bvh_file.empty())
+            mesh = Mesh();
+    }
+
+    // A saved BVH is traversed in place, and replaces the one that would otherwise be built
+    std::optional<MappedBvh> mapped_bvh;
+    Bvh bvh;
+    BasicBvh<uint64_t> wide_bvh;
+    if (!load_bvh_file.empty()) {
+        auto map_time = measure_ms([&] { mapped_bvh = MappedBvh::map(load_bvh_file); });
+        if (!mapped_bvh ||
+            mapped_bvh->prim_count() != mesh.triangle_count() ||
+            mapped_bvh->header.mesh_checksum != checksum(mesh))
+        {
+            std::cerr << "Cannot load BVH file '" << load_bvh_file << "' for this input file" << std::endl;
+            return 1;
+        }
+        std::cout
+            << "Mapped BVH with " << mapped_bvh->node_count() << " node(s), built with "
+            << mapped_bvh->header.builder.name << ", in " << map_time << "ms" << std::endl;
+    } else if (use_index64) {
+        wide_bvh = BasicBvh<uint64_t>::build(input);
+        input = BuildInput();
+        if (layout != wide_bvh.layout)
+            wide_bvh.reorder(layout);
+        std::cout
+            << "Built BVH with 64-bit indices, " << wide_bvh.nodes.size() << " node(s), "
+            << wide_bvh.nodes.size() * sizeof(BasicNode<uint64_t>) << " byte(s) instead of "
+            << wide_bvh.nodes.size() * sizeof(Node) << " byte(s) with 32-bit indices" << std::endl;
+    } else {
+        if (!Bvh::can_index(input.prim_count())) {
+            std::cerr << "Too many triangles for 32-bit indices, use '--index64'" << std::endl;
+            return 1;
+        }
+        bvh = Bvh::build(input);
+        input = BuildInput();
+        std::cout << "Built BVH with " << bvh.nodes.size() << " node(s), depth " << bvh.depth() << std::endl;
+        if (layout != bvh.layout)
+            bvh.reorder(layout);
+        if (use_stackless)
+            bvh.compute_skip_indices();
+        if (!save_bvh_file.empty()) {
+            if (!save_bvh(bvh, builder, mesh, save_bvh_file)) {
+                std::cerr << "Cannot save BVH file '" << save_bvh_file << "'" << std::endl;
+                return 1;
+            }
+            std::cout << "BVH saved as " << save_bvh_file << std::endl;
+        }
+    }
+
+    QuantizedBvh qbvh;
+    if (use_quantized_bvh) {
+        qbvh = QuantizedBvh::build(bvh);
+        std::cout
+            << "Quantized BVH with " << qbvh.nodes.size() << " node(s), "
+            << qbvh.nodes.size() * sizeof(QuantizedNode) << " byte(s) instead of "
+            << bvh.nodes.size() * sizeof(Node) << " byte(s)" << std::endl;
+    }
+
+    PairedBvh pbvh;
+    if (use_paired_bvh) {
+        pbvh = PairedBvh::build(bvh);
+        std::cout << "Paired BVH with " << pbvh.nodes.size() << " node(s)" << std::endl;
+    }
+
+    std::vector<PrecomputedTriangle> precomputed_tris;
+    if (use_precomputed)
+        precomputed_tris = bvh.leaf_ordered<PrecomputedTriangle>(tris);
+
+    // The other modes need the original triangles, so the permutation is applied to copies
+    Bvh permuted_bvh;
+    std::vector<Triangle> permuted_tris;
+    std::vector<uint32_t> original_indices;
+    if (use_permuted) {
+        permuted_bvh = bvh;
+        permuted_tris = tris;
+        original_indices = permuted_bvh.permute(permuted_tris);
+    }
+
+    Bvh blocked_bvh;
+    std::vector<TriangleBlock> blocks;
+    if (use_blocks) {
+        blocked_bvh = bvh;
+        blocked_bvh.collapse_leaves(TriangleBlock::size);
+        blocks = blocked_bvh.pack_leaves<TriangleBlock>(tris);
+        std::cout
+            << "Packed leaves in " << blocks.size() << " block(s) of " << TriangleBlock::size << " triangle(s), "
+            << 100.0f * static_cast<float>(tris.size()) / static_cast<float>(blocks.size() * TriangleBlock::size)
+            << "% of lanes used" << std::endl;
+    }
+
+    dir = normalize(dir);
+    auto right = normalize(cross(dir, up));
+    up = cross(right, dir);
+
+    std::vector<uint8_t> image(width * height * 3);
+    size_t intersections = 0;
+    size_t node_tests = 0;
+    auto direction = [&] (float x, float y) {
+        auto u = 2.0f * x/static_cast<float>(width) - 1.0f;
+        auto v = 2.0f * y/static_cast<float>(height) - 1.0f;
+        return dir + u * right + v * up;
+    };
+    auto generate_ray = [&] (size_t x, size_t y) {
+        Ray ray;
+        ray.org = eye;
+        ray.dir = direction(x, y);
+        ray.tmin = 0;
+        ray.tmax = std::numeric_limits<float>::max();
+        return ray;
+    };
+    auto shade = [&] (size_t x, size_t y, const auto& hit) {
+        if (hit)
+            intersections++;
+        auto pixel = 3 * (y * width + x);
+        image[pixel + 0] = hit.prim_index * 37;
+        image[pixel + 1] = hit.prim_index * 91;
+        image[pixel + 2] = hit.prim_index * 51;
+    };
+    auto render = [&] (auto&& trace) {
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                auto ray = generate_ray(x, y);
+                shade(x, y, trace(ray));
+            }
+            if (y % (height / 10) == 0)
+                std::cout << "." << std::flush;
+        }
+    };
+    auto render_packets = [&] (const auto& bvh, const auto& prims) {
+        static constexpr size_t tile_rows = height / tile_height;
+        for (size_t y = 0; y < height; y += tile_height) {
+            for (size_t x = 0; x < width; x += tile_width) {
+                RayPacket<tile_width * tile_height> packet;
+                for (size_t i = 0; i < tile_height; ++i) {
+                    for (size_t j = 0; j < tile_width; ++j)
+                        packet.set_ray(i * tile_width + j, generate_ray(x + j, y + i));
+                }
+                auto hits = bvh.traverse(packet, prims);
+                for (size_t i = 0; i < tile_height; ++i) {
+                    for (size_t j = 0; j < tile_width; ++j)
+                        shade(x + j, y + i, hits[i * tile_width + j]);
+                }
+            }
+            if ((y / tile_height) % (tile_rows / 10) == 0)
+                std::cout << "." << std::flush;
+        }
+    };
+    auto render_bundles = [&] (const Bvh& bvh) {
+        static constexpr size_t packet_cols = bundle_width / tile_width;
+        static constexpr size_t packet_rows = bundle_height / tile_height;
+        static constexpr size_t bundle_rows = height / bundle_height;
+        for (size_t y = 0; y < height; y += bundle_height) {
+            for (size_t x = 0; x < width; x += bundle_width) {
+                RayBundle<tile_width * tile_height, packet_cols * packet_rows> bundle;
+                // The frustum goes through the corners of the tile, with a margin of half a pixel
+                auto x0 = x - 0.5f, x1 = x + bundle_width - 0.5f;
+                auto y0 = y - 0.5f, y1 = y + bundle_height - 0.5f;
+                Vec3 corners[4] = { direction(x0, y0), direction(x1, y0), direction(x1, y1), direction(x0, y1) };
+                bundle.frustum = Frustum(eye, corners);
+                for (size_t i = 0; i < packet_rows; ++i) {
+                    for (size_t j = 0; j < packet_cols; ++j) {
+                        auto x2 = x0 + j * tile_width, x3 = x2 + tile_width;
+                        auto y2 = y0 + i * tile_height, y3 = y2 + tile_height;
+                        Vec3 packet_corners[4] = { direction(x2, y2), direction(x3, y2), direction(x3, y3), direction(x2, y3) };
+                        bundle.packet_frustums[i * packet_cols + j] = Frustum(eye, packet_corners);
+                    }
+                }
+                for (size_t i = 0; i < bundle_height; ++i) {
+                    for (size_t j = 0; j < bundle_width; ++j) {
+                        auto& packet = bundle.packets[(i / tile_height) * packet_cols + j / tile_width];
+                        packet.set_ray((i % tile_height) * tile_width + j % tile_width, generate_ray(x + j, y + i));
+                    }
+                }
+                auto hits = bvh.traverse(bundle, tris);
+                for (size_t i = 0; i < bundle_height; ++i) {
+                    for (size_t j = 0; j < bundle_width; ++j) {
+                        auto& packet_hits = hits[(i / tile_height) * packet_cols + j / tile_width];
+                        shade(x + j, y + i, packet_hits[(i % tile_height) * tile_width + j % tile_width]);
+                    }
+                }
+                node_tests += bundle.node_tests;
+            }
+            if ((y / bundle_height) % (bundle_rows / 10) == 0)
+                std::cout << "." << std::flush;
+        }
+    };
+    // The prefetch distance is a template parameter, so only a few distances are instantiated
+    auto with_prefetch_distance = [&] (auto&& f) {
+        switch (prefetch_distance) {
+            case 1:  f(std::integral_constant<size_t, 1>()); break;
+            case 2:  f(std::integral_constant<size_t, 2>()); break;
+            case 4:  f(std::integral_constant<size_t, 4>()); break;
+            default: f(std::integral_constant<size_t, 8>()); break;
+        }
+    };
+    std::cout << "Rendering";
+    auto render_time = measure_ms([&] {
+        if (mapped_bvh && use_indexed)
+            render([&] (Ray& ray) { return mapped_bvh->traverse(ray, mesh); });
+        else if (mapped_bvh)
+            render([&] (Ray& ray) { return mapped_bvh->traverse(ray, tris); });
+        else if (use_quantized_bvh)
+            render([&] (Ray& ray) { return qbvh.traverse(ray, tris); });
+        else if (use_paired_bvh)
+            render([&] (Ray& ray) { return pbvh.traverse(ray, tris); });
+        else if (use_precomputed) {
+            render([&] (Ray& ray) {
+                auto hit = bvh.traverse_ordered(ray, precomputed_tris);
+                if (hit)
+                    hit.prim_index = bvh.prim_indices[hit.prim_index];
+                return hit;
+            });
+        } else if (use_permuted) {
+            render([&] (Ray& ray) {
+                auto hit = permuted_bvh.traverse_ordered(ray, permuted_tris);
+                if (hit)
+                    hit.prim_index = original_indices[hit.prim_index];
+                return hit;
+            });
+        } else if (use_blocks)
+            render([&] (Ray& ray) { return blocked_bvh.traverse_blocks(ray, blocks); });
+        else if (use_index64 && use_packets)
+            render_packets(wide_bvh, tris);
+        else if (use_index64)
+            render([&] (Ray& ray) { return wide_bvh.traverse(ray, tris); });
+        else if (use_stackless)
+            render([&] (Ray& ray) { return bvh.traverse_stackless(ray, tris); });
+        else if (prefetch_distance != 0) {
+            with_prefetch_distance([&] (auto distance) {
+                render([&] (Ray& ray) { return bvh.traverse_prefetched<decltype(distance)::value>(ray, tris); });
+            });
+        }
+        else if (use_frustum)
+            render_bundles(bvh);
+        else if (use_indexed && use_packets)
+            render_packets(bvh, mesh);
+        else if (use_indexed)
+            render([&] (Ray& ray) { return bvh.traverse(ray, mesh); });
+        else if (use_packets)
+            render_packets(bvh, tris);
+        else
+            render([&] (Ray& ray) { return bvh.traverse(ray, tris); });
+    });
+    std::cout << "\n" << intersections << " intersection(s) found in " << render_time << "ms" << std::endl;
+    if (use_frustum)
+        std::cout << static_cast<float>(node_tests) / static_cast<float>(width * height) << " node test(s) per ray" << std::endl;
+
+    std::ofstream out(output_file, std::ofstream::binary);
+    out << "P6 " << width << " " << height << " " << 255 << "\n";
+    for(size_t j = height; j > 0; --j)
+        out.write(reinterpret_cast<char*>(image.data() + (j - 1) * 3 * width), sizeof(uint8_t) * 3 * width);
+    std::cout << "Image saved as " << output_file << std::endl;
+
+    if (bench_secondary) {
+        // Incoherent workload: One diffuse bounce from the primary hit point of every pixel. The
+        // primary rays are traced one at a time, since only that traversal returns surface hits.
+        std::vector<Ray> rays;
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                auto ray = generate_ray(x, y);
+                auto hit = bvh.traverse<SurfaceHit>(ray, tris);
+                if (!hit)
+                    continue;
+                auto& tri = tris[hit.prim_index];
+                auto normal = normalize(cross(tri.p0 - tri.p1, tri.p2 - tri.p0));
+                if (dot(normal, ray.dir) > 0)
+                    normal = normal * -1.0f;
+                Vec3 random_dir;
+                do {
+                    random_dir = Vec3(uniform(rng), uniform(rng), uniform(rng));
+                } while (dot(random_dir, random_dir) > 1.0f);
+                Ray bounce;
+                bounce.org = ray.org + ray.dir * hit.t + normal * 1.0e-4f;
+                bounce.dir = normalize(normal + random_dir);
+                bounce.tmin = 0;
+                bounce.tmax = std::numeric_limits<float>::max();
+                rays.push_back(bounce);
+            }
+        }
+
+        size_t single_hits = 0, stream_hits = 0;
+        auto single_time = measure_ms([&] {
+            auto single_rays = rays;
+            for (auto& ray : single_rays)
+                single_hits += bvh.traverse(ray, tris) ? 1 : 0;
+        });
+        auto stream_time = measure_ms([&] {
+            auto stream_rays = rays;
+            for (auto& hit : bvh.traverse(stream_rays, tris))
+                stream_hits += hit ? 1 : 0;
+        });
+        size_t interleaved_hits = 0;
+        auto interleaved_time = measure_ms([&] {
+            auto interleaved_rays = rays;
+            for (auto& hit : bvh.traverse_interleaved<16>(interleaved_rays, tris))
+                interleaved_hits += hit ? 1 : 0;
+        });
+        std::cout
+            << rays.size() << " secondary ray(s), "
+            << "single: " << single_hits << " hit(s) in " << single_time << "ms, "
+            << "stream: " << stream_hits << " hit(s) in " << stream_time << "ms, "
+            << "interleaved: " << interleaved_hits << " hit(s) in " << interleaved_time << "ms" << std::endl;
+
+        if (prefetch_distance != 0) {
+            size_t prefetched_hits = 0;
+            auto prefetched_time = measure_ms([&] {
+                auto prefetched_rays = rays;
+                with_prefetch_distance([&] (auto distance) {
+                    for (auto& ray : prefetched_rays)
+                        prefetched_hits += bvh.traverse_prefetched<decltype(distance)::value>(ray, tris) ? 1 : 0;
+                });
+            });
+            std::cout
+                << "Prefetching at distance " << prefetch_distance << ", "
+                << "single: " << prefetched_hits << " hit(s) in " << prefetched_time << "ms" << std::endl;
+        }
+
+        // Sorting only pays off when it costs less than what it saves during traversal
+        auto sorted_rays = rays;
+        auto sort_time = measure_ms([&] { sort_rays(sorted_rays, bvh.nodes[0].bbox); });
+        size_t sorted_single_hits = 0, sorted_stream_hits = 0;
+        auto sorted_single_time = measure_ms([&] {
+            auto single_rays = sorted_rays;
+            for (auto& ray : single_rays)
+                sorted_single_hits += bvh.traverse(ray, tris) ? 1 : 0;
+        });
+        auto sorted_stream_time = measure_ms([&] {
+            auto stream_rays = sorted_rays;
+            for (auto& hit : bvh.traverse(stream_rays, tris))
+                sorted_stream_hits += hit ? 1 : 0;
+        });
+        std::cout
+            << "Sorted secondary rays in " << sort_time << "ms, "
+            << "single: " << sorted_single_hits << " hit(s) in " << sorted_single_time << "ms, "
+            << "stream: " << sorted_stream_hits << " hit(s) in " << sorted_stream_time << "ms" << std::endl;
+    }
+    return 0;
+}
+
+#endif